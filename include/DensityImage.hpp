@@ -0,0 +1,27 @@
+#ifndef _MPIGRAV_DENSITY_IMAGE_INCLUDED
+#define _MPIGRAV_DENSITY_IMAGE_INCLUDED
+
+#include <vector>
+#include <cstdint>
+
+#include "Master.hpp"
+
+
+// Largest image either end accepts, pixels along each axis
+#define _MPIGRAV_MAX_DENSITY_RESOLUTION 4096
+
+
+// Mass projected onto the x-y plane as a square 8 bit log scaled image,
+// row major, covering [-extent, extent] along both axes
+class DensityImage {
+  public:
+    unsigned resolution;    // Pixels along each axis
+    float extent;           // Half width of the imaged region, meters
+    std::vector<uint8_t> pixels;
+
+  public:
+    DensityImage(void) : resolution(0), extent(0) {}
+};
+
+
+#endif // _MPIGRAV_DENSITY_IMAGE_INCLUDED
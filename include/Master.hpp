@@ -5,5 +5,8 @@
 // Default port
 #define _MPIGRAV_DEFAULT_PORT "9147"
 
+// Default location of cached tuning data & program binaries
+#define _MPIGRAV_DEFAULT_CACHE_DIR "~/.cache/mpigrav"
+
 
 #endif // _MPIGRAV_MASTER_INCLUDED
@@ -4,35 +4,84 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include <boost/asio.hpp>
 
 #include "Body.hpp"
+#include "DensityImage.hpp"
 #include "comm/Signal.hpp"
 
 
+// Receive statistics since the connection was made
+class ClientStats {
+  public:
+    unsigned long frames;
+    unsigned long bytes;
+    double latencySum;    // Frame timestamp to frame fully received
+    double latencyMax;
+    double latencyIntervalMax;  // Since the last interval began
+
+  public:
+    ClientStats(void) :
+      frames(0), bytes(0), latencySum(0), latencyMax(0),
+      latencyIntervalMax(0) {}
+};
+
+
 class Client {
   private:
     boost::asio::io_service ioService;
     boost::asio::ip::tcp::socket socket;
 
     std::thread signalListenerThread;
-    bool done;
+    std::atomic<bool> done;
 
     std::vector<Body> bodyData;
     std::mutex bodyDataMutex;
 
+    // Last density image, if the server streams those instead
+    DensityImage densityData;
+
+    // Motion from the last frames, if the server sends it
+    std::vector<Vec3> velocityData;
+    double frameSimulationTime;   // Simulation clock at the last frame
+    double frameReceived;         // Local wall clock when it arrived
+    double frameInterval;         // Simulated time since the frame before
+    float frameTimestep;
+    double simulationRate;        // Simulated seconds per second, 0 = unknown
+
+    // Receive throttling, bytes per second, 0 = unlimited
+    std::atomic<double> readRate;
+
+    ClientStats stats;
+    std::mutex statsMutex;
+
 //=====[PRIVATE METHODS]=====================================================//
 
     // Internal listener thread functions
     void SignalListenerMain(void);
+    void Recv(void* data, size_t const size);
     signal_t RecvSignal(void);
     int RecvInt(void);
+    double RecvDouble(void);
+    float RecvFloat(void);
     void RecvBodyData(void);
+    void RecvBodyMotion(void);
+    void RecvDensityData(void);
 
   public:
-    Client(std::string const host, int const port);
+    Client(std::string const host, int const port, bool const verbose = true);
+    ~Client(void);
     std::vector<Body> GetBodyData(void);
+    std::vector<Body> GetExtrapolatedBodyData(void);
+    DensityImage GetDensityData(void);
+
+    // For load testing, simulate a slow link & inspect what was received
+    void SetReadRate(double const bytesPerSecond);
+    // A new interval begins once the stats are read, if asked
+    ClientStats GetStats(bool const newInterval = false);
+    bool Connected(void);
 };
 
 
@@ -0,0 +1,153 @@
+#ifndef _MPIGRAV_METRICS_INCLUDED
+#define _MPIGRAV_METRICS_INCLUDED
+
+/*
+ *   Counters, gauges & histograms for monitoring a run. Updates are single
+ *   relaxed atomics, so the compute loop & the server threads never wait on
+ *   each other or on a scrape. Served in the prometheus text format by a
+ *   small http listener on a thread of its own.
+ */
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+
+
+// Only ever goes up
+class Counter {
+  private:
+    std::atomic<uint64_t> value;
+
+  public:
+    Counter(void) : value(0) {}
+
+    void Add(uint64_t const n = 1) {
+      this->value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t Value(void) const {
+      return this->value.load(std::memory_order_relaxed);
+    }
+};
+
+
+// Last value set
+class Gauge {
+  private:
+    std::atomic<double> value;
+
+  public:
+    Gauge(void) : value(0) {}
+
+    void Set(double const x) {
+      this->value.store(x, std::memory_order_relaxed);
+    }
+    double Value(void) const {
+      return this->value.load(std::memory_order_relaxed);
+    }
+};
+
+
+// Fixed buckets, each observation bumps one bucket & the running sum. A
+// scrape may see a bucket bumped before the sum, never anything torn.
+class Histogram {
+  private:
+    std::vector<double> bounds;                       // Upper bounds
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;  // Last one is +Inf
+    std::atomic<double> sum;
+
+  public:
+    // Defaults to durations from 10us to 100s
+    Histogram(void);
+    Histogram(std::vector<double> const& bounds);
+
+    void Observe(double const x);
+
+    // Sample lines only, labels are "" or 'key="value",...'
+    void Write(
+      std::ostream& out,
+      std::string const& name,
+      std::string const& labels) const;
+};
+
+
+// One connected viewer, owned by the server while it stays connected
+class ClientMetrics {
+  public:
+    unsigned id;
+    std::string address;
+    Gauge lag;          // Frame taken to last frame written, seconds
+    Counter frames;
+    Counter bytes;
+};
+
+
+// Where the compute loop's time goes
+typedef enum {
+  PHASE_CHANGES,      // Bodies added & removed
+  PHASE_FORCES,       // Force evaluation & integration
+  PHASE_COLLISIONS,
+  PHASE_REORDER,
+  PHASE_TIMESTEP,     // Picking the next step size
+  PHASE_OUTPUT,       // Snapshots, recording & handing frames to the server
+  PHASE_HALOS,        // Group finding & the catalogue
+  PHASE_COUNT
+} phase_t;
+
+
+class Metrics {
+  private:
+    int port;
+    std::thread listenerThread;
+    std::atomic<bool> done;
+
+    // Expired entries are dropped as they're found while rendering
+    std::list<std::weak_ptr<ClientMetrics>> clients;
+    std::mutex clientsMutex;
+    unsigned clientsCreated;
+
+//====[PRIVATE METHODS]======================================================//
+
+    // Http listener thread
+    void ListenerMain(void);
+
+  public:
+    // Compute loop, left at zero by processes which don't step
+    Counter steps;
+    Counter interactions;       // Pair forces, direct summation only
+    Gauge stepRate;             // Steps per second over the last step
+    Gauge interactionRate;
+    Gauge simulationTime;
+    Histogram stepTime;
+    Histogram phaseTime[PHASE_COUNT];
+
+    // Server threads
+    Gauge clientCount;
+    Counter framesSent;
+    Counter bytesSent;
+    Histogram clientLag;
+
+  public:
+    Metrics(void);
+
+    // Serves /metrics on the loopback interface
+    void Start(int const port);
+
+    // Registers a newly connected viewer, it's forgotten once the caller
+    // lets go of it
+    std::shared_ptr<ClientMetrics> AddClient(std::string const& address);
+
+    // Everything in the prometheus text format
+    std::string Render(void);
+
+    // Stops & joins the listener, waiting out any request still being read
+    ~Metrics(void);
+};
+
+
+#endif // _MPIGRAV_METRICS_INCLUDED
@@ -6,11 +6,22 @@
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <atomic>
 
 #include <boost/asio.hpp>
 
 #include <comm/Signal.hpp>
+#include <comm/Metrics.hpp>
 #include <Body.hpp>
+#include <DensityImage.hpp>
+
+
+// A connected viewer & its metrics, if they're being kept
+class Connection {
+  public:
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+    std::shared_ptr<ClientMetrics> metrics;
+};
 
 
 class Server {
@@ -20,43 +31,98 @@ class Server {
 
     std::thread clientUpdateThread;
     std::thread connectionListenerThread;
-    bool done;
+    std::atomic<bool> done;
 
     std::vector<Body> bodyData;
     std::mutex bodyDataMutex;
 
-    std::list<std::shared_ptr<boost::asio::ip::tcp::socket>> sockets;
+    // Sent in place of bodyData once set, owned by the caller
+    Body const* bodyFrame;
+    unsigned bodyFrameCount;
+
+    // Sent alongside bodies once set, for viewers to extrapolate with
+    std::vector<Vec3> velocityData;
+    double simulationTime;
+    float timestep;
+    bool streamMotion;
+
+    // Streamed instead of bodies once set
+    DensityImage densityData;
+    bool streamDensity;
+
+    std::list<Connection> connections;
     std::mutex socketListMutex;
 
+    // Owned by the caller, null when not kept
+    Metrics* metrics;
+
 //====[PRIVATE METHODS]======================================================//
 
     // Connnection listener thread
     void ConnectionListenerMain(void);
 
-    // Transmit routines
-    void SendSignal(
+    // Transmit routines, returning the bytes written
+    size_t SendSignal(
       std::shared_ptr<boost::asio::ip::tcp::socket> socket,
       signal_t const sig);
-    void SendInt(
+    size_t SendInt(
       std::shared_ptr<boost::asio::ip::tcp::socket> socket,
       int const i);
-    void SendBodyData(
+    size_t SendDouble(
+      std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+      double const d);
+    size_t SendFloat(
+      std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+      float const f);
+    size_t SendBodyData(
       std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-      std::vector<Body> const& buf);
+      Body const* bodies,
+      unsigned const count,
+      double const timestamp);
+    size_t SendBodyMotion(
+      std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+      std::vector<Body> const& buf,
+      std::vector<Vec3> const& velocities,
+      double const simulationTime,
+      float const timestep,
+      double const timestamp);
+    size_t SendDensityData(
+      std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+      DensityImage const& image,
+      std::vector<uint8_t> const& compressed,
+      double const timestamp);
 
     // Client update thread
     void ClientUpdateMain(void);
 
-    // Update connected clients
+    // Update connected clients with a frame taken at timestamp
+    template<typename Send>
+    void ForEachClient(Send const& send, double const timestamp);
 
   public:
     Server();
     Server(std::vector<Body> const& bodyData);
     void Start(int const port, double const updateFrequency);
 
+    // Count clients, frames & bytes sent, call before Start
+    void SetMetrics(Metrics* metrics);
+
     // Sets for various parameters
-    void UpdateClients(std::vector<Body> const& bodies);
+    void UpdateClients(std::vector<Body> const& bodies, double const timestamp);
     void SetBodyData(std::vector<Body> const& bodyData);
+    void SetBodyData(
+      std::vector<Body> const& bodyData,
+      std::vector<Vec3> const& velocityData,
+      double const simulationTime,
+      float const timestep);
+    void SetDensityData(DensityImage const& densityData);
+
+    // Send bodies straight from memory which stays valid & unchanged for
+    // the life of the server, e.g. a mapped recording
+    void SetBodyFrame(Body const* bodies, unsigned const count);
+
+    // Stops & joins the server threads
+    ~Server(void);
 };
 
 
@@ -2,10 +2,23 @@
 #define _MPIGRAV_SIGNAL_INCLUDED
 
 
+#include <chrono>
+
+
 typedef enum {
   SIGNAL_TRANSMIT_BODY_DATA,
-  SIGNAL_CLIENT_DISCONNECT
+  SIGNAL_CLIENT_DISCONNECT,
+  SIGNAL_TRANSMIT_DENSITY_DATA,
+  SIGNAL_TRANSMIT_BODY_MOTION
 } signal_t;
 
 
+// Wall clock in seconds, used to timestamp frames. Comparable between
+// processes on the same host, e.g. a server & load generator on loopback.
+inline double WallClock(void) {
+  using namespace std::chrono;
+  return duration<double>(system_clock::now().time_since_epoch()).count();
+}
+
+
 #endif // _MPIGRAV_REQUEST_INCLUDED
@@ -0,0 +1,89 @@
+#ifndef _MPIGRAV_TRAJECTORY_INCLUDED
+#define _MPIGRAV_TRAJECTORY_INCLUDED
+
+/*
+ *   Recorded trajectories, a header followed by one frame per snapshot.
+ *   Each frame is a FrameHeader then its bodies, so frames can be sent
+ *   straight out of a mapping of the file.
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+#include "Body.hpp"
+
+
+#define _MPIGRAV_TRAJECTORY_MAGIC "MPIGRAVT"
+#define _MPIGRAV_TRAJECTORY_VERSION 1
+
+
+class TrajectoryHeader {
+  public:
+    char magic[8];
+    uint32_t version;
+    uint32_t bodySize;        // sizeof(Body) of the recording process
+};
+
+
+class FrameHeader {
+  public:
+    uint32_t bodyCount;
+    uint32_t reserved;
+    double simulationTime;
+};
+
+
+// Appends frames to a new recording, each one flushed as it's written so
+// that a run which dies early still leaves a readable file
+class TrajectoryWriter {
+  private:
+    std::ofstream file;
+
+  public:
+    TrajectoryWriter(std::string const& path);
+
+    void Write(std::vector<Body> const& bodies, double const simulationTime);
+};
+
+
+// Read only mapping of a recording, indexed on open so any frame can be
+// reached directly. A partly written last frame is ignored.
+class TrajectoryReader {
+  private:
+    int fd;
+    char const* base;
+    size_t bytes;
+    std::vector<size_t> frameOffsets;
+
+    FrameHeader const& Frame(unsigned const frame) const {
+      return *(FrameHeader const*)(this->base + this->frameOffsets[frame]);
+    }
+
+  public:
+    TrajectoryReader(std::string const& path);
+
+    // Owns its mapping, not copyable
+    TrajectoryReader(TrajectoryReader const&) = delete;
+    TrajectoryReader& operator=(TrajectoryReader const&) = delete;
+
+    unsigned FrameCount(void) const { return this->frameOffsets.size(); }
+
+    // Views into the mapping, valid for the life of the reader
+    Body const* Bodies(unsigned const frame) const {
+      return (Body const*)(&this->Frame(frame) + 1);
+    }
+    unsigned BodyCount(unsigned const frame) const {
+      return this->Frame(frame).bodyCount;
+    }
+    double SimulationTime(unsigned const frame) const {
+      return this->Frame(frame).simulationTime;
+    }
+
+    ~TrajectoryReader(void);
+};
+
+
+#endif // _MPIGRAV_TRAJECTORY_INCLUDED
@@ -0,0 +1,51 @@
+#ifndef _MPIGRAV_DENSITY_INCLUDED
+#define _MPIGRAV_DENSITY_INCLUDED
+
+
+// standard
+#include <vector>
+
+
+// External
+#include "mpi.h"
+
+
+// Internal
+#include "Master.hpp"
+#include "DensityImage.hpp"
+#include "util/Vec3.hpp"
+
+
+// Ratio of the brightest to the dimmest visible cell in density images
+#define _MPIGRAV_DENSITY_DYNAMIC_RANGE 1.0e4f
+
+
+// Mass projected along z onto a square grid centred on the origin. Each
+// rank deposits its own domain & the grids are summed onto one rank, so
+// the image costs the same whatever the body count.
+class DensityProjection {
+  private:
+    unsigned resolution;
+    float extent;
+    std::vector<float> grid;
+
+  public:
+    DensityProjection(unsigned const resolution, float const extent);
+
+    unsigned GetResolution(void) const { return this->resolution; }
+    std::vector<float>& Grid(void) { return this->grid; }
+    std::vector<float> const& Grid(void) const { return this->grid; }
+
+    // Replace the grid with a domain's mass, bodies outside are dropped
+    void Deposit(
+      float const* m, Vec3 const* r, unsigned const start, unsigned const end);
+
+    // Sum the grids of all ranks onto the root
+    void Reduce(int const root, MPI_Comm const comm);
+
+    // Log scaled image of the grid, the densest cell is the brightest
+    DensityImage Image(void) const;
+};
+
+
+#endif // _MPIGRAV_DENSITY_INCLUDED
@@ -0,0 +1,110 @@
+#ifndef _MPIGRAV_ENSEMBLE_INCLUDED
+#define _MPIGRAV_ENSEMBLE_INCLUDED
+
+
+// standard
+#include <vector>
+#include <string>
+
+
+// External
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#include <CL/cl2.hpp>
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+#include "Body.hpp"
+#include "compute/Universe.hpp"
+
+
+// Initial bodies & parameters for one member of an ensemble
+class EnsembleMember {
+  public:
+    std::vector<Body> bodies;
+    float G;
+    float dt;
+    float e;
+};
+
+
+// Many small independent universes packed into one set of buffers and
+// advanced together, one opencl launch or one openmp region per step.
+// Whole universes are assigned to ranks so no communication is needed
+// while stepping. Leapfrog only.
+class Ensemble {
+  private:
+    // Which universes each rank is responsible for
+    std::vector<unsigned> rankUniverseCounts;
+    std::vector<unsigned> rankUniverseOffsets;
+
+    // Local universes, bodies of universe u are [bodyOffsets[u], [u + 1])
+    std::vector<unsigned> bodyOffsets;
+    std::vector<unsigned> bodyUniverse;
+    std::vector<float> G;
+    std::vector<float> dt;
+    std::vector<float> e;
+
+    // Packed integrator terms for all local universes
+    unsigned bodyCount;
+    std::vector<float> m;
+    std::vector<Vec3> r;
+    std::vector<Vec3> v;
+    std::vector<Vec3> a;
+    std::vector<Vec3> rNext;
+    std::vector<Vec3> vNext;
+    std::vector<Vec3> aNext;
+
+    // OpenCL handles, terms stay on the device between opencl steps
+    bool deviceCurrent;
+    cl::Context clContext;
+    cl::Device clDevice;
+    cl::CommandQueue clCommandQueue;
+    cl::Program clProgram;
+    cl::Kernel clKernel;
+    KernelConfig clKernelConfig;
+    unsigned clGroupCount;
+
+    cl::Buffer clBuf_m;
+    cl::Buffer clBuf_r;
+    cl::Buffer clBuf_v;
+    cl::Buffer clBuf_a;
+    cl::Buffer clBuf_rNext;
+    cl::Buffer clBuf_vNext;
+    cl::Buffer clBuf_aNext;
+    cl::Buffer clBuf_params;
+    cl::Buffer clBuf_universes;
+    cl::Buffer clBuf_groupUniverse;
+
+//====[METHODS]==============================================================//
+
+    // Assigns contiguous runs of universes to ranks, balancing pair counts
+    void DistributeWork(std::vector<EnsembleMember> const& members);
+
+    void InitCL(std::string const& cacheDir);
+    void SetKernelBufferArgs(void);
+    void WriteDeviceBuffers(void);
+    void ReadDeviceBuffers(void);
+
+    unsigned LocalUniverseCount(void);
+
+  public:
+    Ensemble(
+      std::vector<EnsembleMember> const& members,
+      std::string const& cacheDir = _MPIGRAV_DEFAULT_CACHE_DIR);
+
+    // Iteration routines, advance every local universe by its own dt
+    double Iterate(void);     // Openmp brute force
+    double IterateCL(void);   // Opencl, single launch
+    double Iterate(engine_t const engine);
+
+    // Universe indices are global, data is only available on the owner
+    unsigned GetUniverseCount(void);
+    bool Owns(unsigned const universe);
+    std::vector<Body> GetBodyData(unsigned const universe);
+};
+
+
+#endif // _MPIGRAV_ENSEMBLE_INCLUDED
@@ -0,0 +1,21 @@
+#ifndef _MPIGRAV_FFT_INCLUDED
+#define _MPIGRAV_FFT_INCLUDED
+
+
+// standard
+#include <complex>
+
+
+// Internal
+#include "Master.hpp"
+
+
+typedef std::complex<float> complex_t;
+
+
+// In-place radix-2 complex fft of n contiguous values, n a power of two
+// The inverse transform is unscaled
+void FFT(complex_t* data, unsigned const n, bool const inverse);
+
+
+#endif // _MPIGRAV_FFT_INCLUDED
@@ -0,0 +1,96 @@
+#ifndef _MPIGRAV_HALOS_INCLUDED
+#define _MPIGRAV_HALOS_INCLUDED
+
+
+// standard
+#include <string>
+#include <vector>
+#include <fstream>
+
+
+// External
+#include "mpi.h"
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+
+
+// Linking length as a fraction of the mean spacing, when none is given
+#define _MPIGRAV_DEFAULT_LINKING_FRACTION 0.2f
+
+
+// One friends-of-friends group
+class Halo {
+  public:
+    float m;
+    Vec3 r;                 // Centre of mass
+    Vec3 v;                 // Centre of mass velocity
+    unsigned memberCount;
+};
+
+
+// Friends-of-friends groups of the sources, tracers are never members.
+// Each rank links its own domain against every source within the linking
+// length & the groups are merged across ranks by repeatedly taking the
+// smallest label any rank has for each body, so only the catalogue of
+// groups with enough members is kept.
+class HaloFinder {
+  private:
+    float linkingLength;              // 0 = a fraction of the mean spacing
+    unsigned minMembers;
+
+    // Union-find forest over storage indices, roots are the smallest index
+    // of their group
+    std::vector<unsigned> parent;
+    std::vector<unsigned> labels;
+
+    std::vector<Halo> halos;
+
+//====[PRIVATE METHODS]======================================================//
+
+    unsigned Root(unsigned i);
+    void Link(unsigned const i, unsigned const j);
+
+    float LinkingLength(float const* m, Vec3 const* r, unsigned const count);
+    void LinkDomain(
+      float const* m, Vec3 const* r, unsigned const count,
+      unsigned const start, unsigned const end, float const b);
+    void MergeRanks(MPI_Comm const comm);
+    void Catalogue(
+      float const* m, Vec3 const* r, Vec3 const* v, unsigned const count,
+      unsigned const start, unsigned const end, MPI_Comm const comm);
+
+  public:
+    HaloFinder(float const linkingLength, unsigned const minMembers);
+
+    // Every rank must call this with every source's current position, its
+    // own sources [start, end) & their velocities. Each rank gets the
+    // whole catalogue.
+    void Find(
+      float const* m, Vec3 const* r, Vec3 const* v, unsigned const count,
+      unsigned const start, unsigned const end, MPI_Comm const comm);
+
+    // Largest first
+    std::vector<Halo> const& Halos(void) const { return this->halos; }
+};
+
+
+// Appends one text block per catalogue, a header line with the step, the
+// simulation time & the halo count followed by a line per halo
+class HaloCatalogueWriter {
+  private:
+    std::ofstream file;
+
+  public:
+    HaloCatalogueWriter(std::string const& path);
+
+    void Write(
+      std::vector<Halo> const& halos,
+      unsigned const step,
+      double const simulationTime);
+};
+
+
+#endif // _MPIGRAV_HALOS_INCLUDED
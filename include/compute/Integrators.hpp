@@ -0,0 +1,153 @@
+#ifndef _MPIGRAV_INTEGRATORS_INCLUDED
+#define _MPIGRAV_INTEGRATORS_INCLUDED
+
+
+// standard
+#include <string>
+#include <cmath>
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+
+
+// Integrators selectable at startup, fixed for the life of a universe
+typedef enum {
+  INTEGRATOR_LEAPFROG,    // Second order, one force evaluation per step
+  INTEGRATOR_HERMITE,     // Fourth order predictor-corrector, uses jerk
+  INTEGRATOR_YOSHIDA      // Fourth order symplectic, three force evaluations
+} integrator_t;
+
+integrator_t ParseIntegrator(std::string const& str);
+
+// Kernel build options selecting the matching force loop
+std::string IntegratorBuildOptions(integrator_t const integrator);
+
+
+// Views of the integrator terms for one step. The current state is read
+// from r, v, a & j and the next state written to the *Next buffers for
+// bodies [start, end).
+class StepState {
+  public:
+    Vec3* r;
+    Vec3* v;
+    Vec3* a;
+    Vec3* j;
+    Vec3* rNext;
+    Vec3* vNext;
+    Vec3* aNext;
+    Vec3* jNext;
+    unsigned start;
+    unsigned end;
+    float dt;
+};
+
+
+// Integrator policies. Step() advances [start, end) by one step, calling
+// forces(rEval, vEval, aOut, jOut) to get accelerations (and the jerk, if
+// jOut is not null) on [start, end) with every body at rEval. Evaluation
+// buffers only need to be valid on [start, end), the force functor is
+// responsible for sharing them between ranks.
+
+// Leapfrog with the acceleration evaluated at the start of the step
+class Leapfrog {
+  public:
+    static bool const primed = false;   // Accepts a = 0 on the first step
+    static bool const jerk = false;
+
+    static void Integrate(StepState const& s, unsigned const i) {
+
+      // Compute next position
+      s.rNext[i] =
+        s.r[i] + (s.v[i] * s.dt) + ((s.a[i] * (s.dt * s.dt)) / 2);
+
+      // Compute next velocity
+      s.vNext[i] = s.v[i] + (((s.a[i] + s.aNext[i]) / 2) * s.dt);
+    }
+
+    template<typename Forces>
+    static void Step(StepState const& s, Forces& forces) {
+      forces(s.r, nullptr, s.aNext, nullptr);
+
+      #pragma omp parallel for schedule(static)
+      for(unsigned i = s.start; i < s.end; i++) Integrate(s, i);
+    }
+};
+
+
+// Fourth order hermite, predict with a & j, re-evaluate, then correct
+class Hermite {
+  public:
+    static bool const primed = true;
+    static bool const jerk = true;
+
+    template<typename Forces>
+    static void Step(StepState const& s, Forces& forces) {
+      float dt = s.dt;
+      float dt2 = dt * dt;
+      float dt3 = dt2 * dt;
+
+      #pragma omp parallel for schedule(static)
+      for(unsigned i = s.start; i < s.end; i++) {
+        s.rNext[i] =
+          s.r[i] + (s.v[i] * dt) + (s.a[i] * (dt2 / 2)) + (s.j[i] * (dt3 / 6));
+        s.vNext[i] = s.v[i] + (s.a[i] * dt) + (s.j[i] * (dt2 / 2));
+      }
+
+      forces(s.rNext, s.vNext, s.aNext, s.jNext);
+
+      #pragma omp parallel for schedule(static)
+      for(unsigned i = s.start; i < s.end; i++) {
+        Vec3 v =
+          s.v[i] +
+          ((s.a[i] + s.aNext[i]) * (dt / 2)) +
+          ((s.j[i] - s.jNext[i]) * (dt2 / 12));
+        s.rNext[i] =
+          s.r[i] +
+          ((s.v[i] + v) * (dt / 2)) +
+          ((s.a[i] - s.aNext[i]) * (dt2 / 12));
+        s.vNext[i] = v;
+      }
+    }
+};
+
+
+// Forest-Ruth/Yoshida fourth order composition of three kick-drift-kick
+// leapfrog steps. The final acceleration is reused to open the next step.
+class Yoshida {
+  public:
+    static bool const primed = true;
+    static bool const jerk = false;
+
+    template<typename Forces>
+    static void Step(StepState const& s, Forces& forces) {
+      double w1 = 1 / (2 - std::cbrt(2.0));
+      double w0 = 1 - (2 * w1);
+      float drift[3] = {(float)w1, (float)w0, (float)w1};
+      float kick[4] = {
+        (float)(w1 / 2), (float)((w0 + w1) / 2),
+        (float)((w0 + w1) / 2), (float)(w1 / 2)};
+
+      #pragma omp parallel for schedule(static)
+      for(unsigned i = s.start; i < s.end; i++) {
+        s.vNext[i] = s.v[i] + (s.a[i] * (kick[0] * s.dt));
+        s.rNext[i] = s.r[i] + (s.vNext[i] * (drift[0] * s.dt));
+      }
+
+      for(int k = 1; k < 4; k++) {
+        forces(s.rNext, nullptr, s.aNext, nullptr);
+
+        #pragma omp parallel for schedule(static)
+        for(unsigned i = s.start; i < s.end; i++) {
+          s.vNext[i] = s.vNext[i] + (s.aNext[i] * (kick[k] * s.dt));
+          if(k < 3) {
+            s.rNext[i] = s.rNext[i] + (s.vNext[i] * (drift[k] * s.dt));
+          }
+        }
+      }
+    }
+};
+
+
+#endif // _MPIGRAV_INTEGRATORS_INCLUDED
@@ -0,0 +1,94 @@
+#ifndef _MPIGRAV_KERNEL_TUNER_INCLUDED
+#define _MPIGRAV_KERNEL_TUNER_INCLUDED
+
+
+// standard
+#include <string>
+#include <vector>
+#include <functional>
+
+
+// Internal
+#include "Master.hpp"
+
+
+// Name of the tuning cache within the cache directory
+#define _MPIGRAV_TUNING_CACHE_FILE "tuning.cache"
+
+
+// Kernel autotuning behaviour
+typedef enum {
+  TUNING_OFF,     // Always use the default configuration
+  TUNING_AUTO,    // Use the cached configuration, tune on a cache miss
+  TUNING_FORCE    // Always tune, overwrite any cached configuration
+} tuning_mode_t;
+
+tuning_mode_t ParseTuningMode(std::string const& str);
+
+
+// Kernel launch parameters, passed to the kernel as -D build options
+class KernelConfig {
+  public:
+    unsigned workGroupSize;   // Work items per work group
+    unsigned bodiesPerItem;   // Bodies integrated by each work item
+    unsigned unrollFactor;    // Unroll factor of the inner loop
+    unsigned tileSize;        // Bodies staged in local memory at a time
+
+  public:
+    KernelConfig(void) :
+      workGroupSize(64), bodiesPerItem(1), unrollFactor(1), tileSize(64) {}
+
+    std::string BuildOptions(void) const;
+    std::string Str(void) const;
+
+    // Local memory used by the largest kernel, hermite stages velocities
+    unsigned long LocalBytes(bool const jerk) const;
+
+    // Whether the configuration is usable on a device with these limits
+    bool Fits(
+      unsigned const maxWorkGroupSize,
+      unsigned long const localMem,
+      bool const jerk) const;
+};
+
+
+// On-disk store of tuned configurations, one line per key
+class TuningCache {
+  private:
+    std::string path;
+
+  public:
+    TuningCache(std::string const& path);
+
+    // Cache key, variant names the kernel timed & its build options, the
+    // domain & the sources it loops over are bucketed by power of two
+    static std::string Key(
+      std::string const& device, std::string const& driver,
+      std::string const& variant,
+      unsigned const domainSize, unsigned const sourceCount);
+
+    bool Lookup(std::string const& key, KernelConfig& config);
+    void Store(std::string const& key, KernelConfig const& config);
+};
+
+
+// Greedy coordinate search over the tuning space
+class KernelTuner {
+  private:
+    std::vector<unsigned> workGroupSizes;
+    std::vector<unsigned> bodiesPerItems;
+    std::vector<unsigned> unrollFactors;
+    std::vector<unsigned> tileSizes;
+
+  public:
+    KernelTuner(void);
+
+    // Returns the fastest configuration found, benchmark returns seconds
+    KernelConfig Tune(
+      KernelConfig const& start,
+      std::function<bool(KernelConfig const&)> const& valid,
+      std::function<double(KernelConfig const&)> const& benchmark);
+};
+
+
+#endif // _MPIGRAV_KERNEL_TUNER_INCLUDED
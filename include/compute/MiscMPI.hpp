@@ -5,12 +5,14 @@
  *   Some handy functions to make using MPI less of a pain
  */
 
+#include "mpi.h"
+
 
 int MyRank(void);
-int MyRank(int const comm);
+int MyRank(MPI_Comm const comm);
 
 int RankCount(void);
-int RankCount(int const comm);
+int RankCount(MPI_Comm const comm);
 
 
 #endif // _MPI_MISC_TOOLS_INCLUDED
@@ -0,0 +1,33 @@
+#ifndef _MPIGRAV_MORTON_INCLUDED
+#define _MPIGRAV_MORTON_INCLUDED
+
+
+// standard
+#include <vector>
+#include <cstdint>
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+
+
+// Bits per axis & in total of a morton key
+#define _MPIGRAV_MORTON_AXIS_BITS 10
+#define _MPIGRAV_MORTON_KEY_BITS (3 * _MPIGRAV_MORTON_AXIS_BITS)
+
+// Key bits handled by each radix sort pass
+#define _MPIGRAV_RADIX_BITS 8
+
+
+// Morton (z-order) key of each position within the bounding cube of all of
+// them, nearby keys are nearby in space
+std::vector<uint32_t> MortonKeys(Vec3 const* r, unsigned const count);
+
+// Order which stably sorts the keys, by parallel lsd radix sort. The result
+// doesn't depend on the thread count.
+std::vector<unsigned> SortOrder(
+  std::vector<uint32_t> const& keys, unsigned const keyBits);
+
+
+#endif // _MPIGRAV_MORTON_INCLUDED
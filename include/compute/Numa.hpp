@@ -0,0 +1,52 @@
+#ifndef _MPIGRAV_NUMA_INCLUDED
+#define _MPIGRAV_NUMA_INCLUDED
+
+/*
+ *   Memory & thread placement helpers for multi-socket machines
+ */
+
+#include <string>
+#include <cstddef>
+
+#include "Master.hpp"
+
+
+// How arena memory should be backed
+typedef enum {
+  HUGEPAGES_OFF,            // Regular pages
+  HUGEPAGES_TRANSPARENT,    // Ask the kernel for transparent huge pages
+  HUGEPAGES_EXPLICIT        // Reserved huge pages, transparent if unavailable
+} hugepage_mode_t;
+
+hugepage_mode_t ParseHugePageMode(std::string const& str);
+
+
+// Huge page aligned anonymous mapping, pages are not placed until touched
+class Arena {
+  private:
+    void* base;
+    size_t bytes;
+
+  public:
+    Arena(void) : base(nullptr), bytes(0) {}
+    Arena(size_t const bytes, hugepage_mode_t const mode);
+
+    // Owns its mapping, may be moved but not copied
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+    Arena(Arena&& other);
+    Arena& operator=(Arena&& other);
+
+    void* Data(void) const { return this->base; }
+    size_t Size(void) const { return this->bytes; }
+
+    ~Arena(void);
+};
+
+
+// Pin each openmp worker thread to one cpu of the process's affinity mask,
+// the main thread is left free to run anywhere in it
+void PinThreads(void);
+
+
+#endif // _MPIGRAV_NUMA_INCLUDED
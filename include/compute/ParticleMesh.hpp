@@ -0,0 +1,94 @@
+#ifndef _MPIGRAV_PARTICLE_MESH_INCLUDED
+#define _MPIGRAV_PARTICLE_MESH_INCLUDED
+
+
+// standard
+#include <vector>
+
+
+// External
+#include "mpi.h"
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+#include "compute/FFT.hpp"
+
+
+// Whether a mesh of gridSize cells per axis splits into slabs over ranks,
+// it must be a power of two & a multiple of the rank count
+bool ValidMeshSize(int const gridSize, int const rankCount);
+
+
+// A body sent to the rank owning the slab it's deposited on
+class MeshBody {
+  public:
+    Vec3 r;
+    float m;
+};
+
+
+// Periodic particle-mesh gravity solver. Mass is assigned to a grid with
+// cloud-in-cell weights, poisson's equation is solved with an fft that is
+// distributed over ranks as slabs of x planes, and accelerations are
+// interpolated back from a finite difference gradient of the potential.
+// The box is centred on the origin. Accelerations are returned with G = 1.
+// Bodies are sent to the rank whose slab holds their lower cloud-in-cell
+// plane & their accelerations sent back, so each rank only holds its slab
+// & a few ghost planes of the grid.
+class ParticleMesh {
+  private:
+    MPI_Comm comm;
+    unsigned gridSize;
+    float boxSize;
+    float cellSize;
+
+    // This rank's x planes in the forward layout, or y rows once transposed
+    unsigned slabSize;
+    unsigned slabStart;
+
+    // Slab density & the plane after it, which is folded into the next
+    // rank's slab. Slab potential with one plane before & two after.
+    std::vector<float> density;
+    std::vector<float> potential;
+    std::vector<complex_t> slab;        // [x][y][z], local x planes
+    std::vector<complex_t> transposed;  // [y][x][z], local y rows
+    std::vector<complex_t> sendBuf;
+    std::vector<complex_t> recvBuf;
+    std::vector<complex_t> line;
+
+    // Index into a stack of planes, y & z wrap around
+    unsigned Index(unsigned plane, int y, int z) const;
+
+    // Cloud-in-cell cell & weights for a position, the x cell is wrapped
+    void CloudInCell(Vec3 const& p, int* cell, float* frac) const;
+
+    void Deposit(std::vector<MeshBody> const& bodies);
+    void SolvePotential(void);
+    void ShareGhostPlanes(void);
+    void ExchangePlane(
+      std::vector<float>& grid, unsigned const plane, int const shift,
+      float* recv);
+    Vec3 Interpolate(Vec3 const& p) const;
+    void Transpose(bool const forward);
+    void FFTLines(
+      complex_t* data, unsigned const count, unsigned const stride,
+      unsigned const lineStride, bool const inverse);
+
+  public:
+    ParticleMesh(
+      unsigned const gridSize, float const boxSize, MPI_Comm const comm);
+
+    // Accelerations on bodies [start, end) due to the bodies every rank
+    // passes for its own [start, end)
+    void ComputeAccelerations(
+      float const* m, Vec3 const* r,
+      unsigned const start, unsigned const end, Vec3* aOut);
+
+    // Wrap a position back into the periodic box
+    Vec3 Wrap(Vec3 p) const;
+};
+
+
+#endif // _MPIGRAV_PARTICLE_MESH_INCLUDED
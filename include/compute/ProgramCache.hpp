@@ -0,0 +1,51 @@
+#ifndef _MPIGRAV_PROGRAM_CACHE_INCLUDED
+#define _MPIGRAV_PROGRAM_CACHE_INCLUDED
+
+
+// standard
+#include <string>
+
+
+// External
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#include <CL/cl2.hpp>
+
+
+// Internal
+#include "Master.hpp"
+
+
+// Subdirectory of the cache directory holding program binaries
+#define _MPIGRAV_PROGRAM_CACHE_SUBDIR "programs"
+
+
+// Loads kernel source, embedded at build time or relative to the executable
+std::string LoadKernelSource(std::string const& path);
+
+
+// On-disk cache of compiled program binaries
+// Entries are keyed by a hash of the source, device, driver & build options
+class ProgramCache {
+  private:
+    std::string dir;
+
+    std::string EntryPath(
+      cl::Device const& device,
+      std::string const& source,
+      std::string const& options);
+
+  public:
+    ProgramCache(void);
+    ProgramCache(std::string const& cacheDir);
+
+    // Returns a built program, loaded from a cached binary when possible
+    cl::Program Build(
+      cl::Context const& context,
+      cl::Device const& device,
+      std::string const& source,
+      std::string const& options);
+};
+
+
+#endif // _MPIGRAV_PROGRAM_CACHE_INCLUDED
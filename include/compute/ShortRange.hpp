@@ -0,0 +1,62 @@
+#ifndef _MPIGRAV_SHORT_RANGE_INCLUDED
+#define _MPIGRAV_SHORT_RANGE_INCLUDED
+
+
+// standard
+#include <string>
+#include <cmath>
+
+
+// Internal
+#include "Master.hpp"
+
+
+// Pair forces for the short range mode, where bodies further apart than a
+// cutoff don't interact at all. Values match the FORCE_* macros in the
+// kernel source.
+typedef enum {
+  FORCE_TRUNCATED,    // Softened newtonian, dropped beyond the cutoff
+  FORCE_SHIFTED,      // Newtonian less its value at the cutoff, no jump
+  FORCE_SCREENED      // Yukawa, newtonian with an exponential screening
+} force_law_t;
+
+force_law_t ParseForceLaw(std::string const& str);
+
+// Kernel build options selecting the matching pair force
+std::string ForceLawBuildOptions(force_law_t const law);
+
+
+// Constants of the pair force for one evaluation
+class ShortRangeParams {
+  public:
+    float cutoff2;
+    float e2;
+    float shift;              // Shifted force's value at the cutoff
+    float screeningInverse;   // 1 / screening length
+
+  public:
+    ShortRangeParams(
+      float const cutoff, float const e, float const screeningLength) :
+      cutoff2(cutoff * cutoff),
+      e2(e * e),
+      shift(1 / ((cutoff * cutoff) + (e * e))),
+      screeningInverse(1 / screeningLength) {}
+};
+
+
+// Scale s such that a source at dr with 0 < |dr| < cutoff adds dr * m * s
+// to the unscaled acceleration, the law is fixed for each force loop
+template<force_law_t law>
+inline float PairScale(float const r2, ShortRangeParams const& p) {
+  float rInverse = 1 / sqrt(r2);
+  float d2 = r2 + p.e2;
+  if(law == FORCE_SHIFTED) return ((1 / d2) - p.shift) * rInverse;
+  if(law == FORCE_SCREENED) {
+    float x = r2 * rInverse * p.screeningInverse;
+    return exp(-x) * (1 + x) * rInverse / d2;
+  }
+  return rInverse / d2;
+}
+
+
+#endif // _MPIGRAV_SHORT_RANGE_INCLUDED
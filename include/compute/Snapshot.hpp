@@ -0,0 +1,82 @@
+#ifndef _MPIGRAV_SNAPSHOT_INCLUDED
+#define _MPIGRAV_SNAPSHOT_INCLUDED
+
+
+// standard
+#include <vector>
+
+
+// External
+#include "mpi.h"
+
+
+// Internal
+#include "Master.hpp"
+#include "Body.hpp"
+#include "compute/Universe.hpp"
+#include "compute/Density.hpp"
+
+
+// How long the root sleeps between polls while waiting for a snapshot
+#define _MPIGRAV_SNAPSHOT_POLL_MS 1
+
+
+// Body snapshots or density projections gathered from the compute ranks
+// onto a dedicated rank. Every rank of the communicator takes part & the
+// root contributes nothing. Compute ranks post each gather & carry on
+// stepping, their contribution is kept until the gather completes.
+// Snapshots can carry velocities & the simulation clock for viewers which
+// extrapolate between frames.
+class SnapshotStream {
+  private:
+    MPI_Comm comm;
+    int root;
+    bool velocities;
+
+    // Compute side, header is body count, simulation time & timestep
+    double header[3];
+    std::vector<Body> domain;
+    std::vector<Vec3> domainVelocities;
+    std::vector<float> density;
+    std::vector<MPI_Request> requests;
+
+    // Root side
+    std::vector<double> rankHeaders;
+    std::vector<int> rankByteCounts;
+    std::vector<int> rankByteOffsets;
+    std::vector<Body> bodies;
+    std::vector<Vec3> bodyVelocities;
+    double simulationTime;
+    float timestep;
+
+    void Wait(MPI_Request* request);
+    void GatherRoot(void* buffer, size_t const itemSize);
+
+  public:
+    SnapshotStream(
+      MPI_Comm const comm, int const root, bool const velocities = false);
+
+    // Compute ranks, posts a gather of this rank's domain or a reduction
+    // of its projected density
+    void Send(Universe& universe);
+    void Send(DensityProjection const& projection);
+
+    // Compute ranks, progresses the last gather & waits for it to complete
+    void Poll(void);
+    void Finish(void);
+
+    // Root, waits for the next snapshot in body order or the next
+    // projection summed over the compute ranks
+    std::vector<Body> const& Receive(void);
+    void Receive(DensityProjection& projection);
+
+    // Root, the rest of the last snapshot if velocities were requested
+    std::vector<Vec3> const& GetVelocities(void) const {
+      return this->bodyVelocities;
+    }
+    double GetSimulationTime(void) const { return this->simulationTime; }
+    float GetTimestep(void) const { return this->timestep; }
+};
+
+
+#endif // _MPIGRAV_SNAPSHOT_INCLUDED
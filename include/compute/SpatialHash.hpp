@@ -0,0 +1,92 @@
+#ifndef _MPIGRAV_SPATIAL_HASH_INCLUDED
+#define _MPIGRAV_SPATIAL_HASH_INCLUDED
+
+
+// standard
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+
+// Internal
+#include "Master.hpp"
+#include "util/Vec3.hpp"
+
+
+// Uniform grid of cubic cells hashed into a table of buckets, built in
+// parallel with a counting sort. Neighbour queries visit the 27 cells
+// around a point, bodies from colliding cells must be filtered by distance.
+// The hash & cell arithmetic are mirrored by the short range kernel.
+class SpatialHash {
+  private:
+    float cellInverse;
+    unsigned tableMask;
+
+    std::vector<unsigned> bucketStart;    // Offset of each bucket, +1 end
+    std::vector<unsigned> bucketBodies;   // Body indices sorted by bucket
+
+    unsigned Bucket(int const x, int const y, int const z) const {
+      return (
+        ((unsigned)x * 73856093u) ^
+        ((unsigned)y * 19349663u) ^
+        ((unsigned)z * 83492791u)) & this->tableMask;
+    }
+
+    int Cell(float const coord) const {
+      return (int)std::floor(coord * this->cellInverse);
+    }
+
+  public:
+    SpatialHash(float const cellSize);
+
+    // Bin bodies by position, cell size should be at least the query radius
+    void Build(Vec3 const* r, unsigned const count);
+
+    // Bodies in bucket order & the offset of each bucket in it, +1 end
+    std::vector<unsigned> const& Order(void) const {
+      return this->bucketBodies;
+    }
+    std::vector<unsigned> const& BucketStarts(void) const {
+      return this->bucketStart;
+    }
+    unsigned TableMask(void) const { return this->tableMask; }
+    float CellInverse(void) const { return this->cellInverse; }
+
+    // Calls f(j) once for every body in the 27 cells around p
+    template<typename F>
+    void ForEachNeighbour(Vec3 const& p, F const& f) const {
+      this->ForEachNeighbourRange(p, [&](unsigned start, unsigned end) {
+        for(unsigned n = start; n < end; n++) f(this->bucketBodies[n]);
+      });
+    }
+
+    // Calls f(start, end) once for every bucket holding the 27 cells around
+    // p, with [start, end) a range of Order()
+    template<typename F>
+    void ForEachNeighbourRange(Vec3 const& p, F const& f) const {
+      int cx = this->Cell(p.x);
+      int cy = this->Cell(p.y);
+      int cz = this->Cell(p.z);
+
+      // Several cells may share a bucket, visit each bucket once
+      unsigned buckets[27];
+      unsigned bucketCount = 0;
+      for(int dx = -1; dx <= 1; dx++) {
+        for(int dy = -1; dy <= 1; dy++) {
+          for(int dz = -1; dz <= 1; dz++) {
+            unsigned b = this->Bucket(cx + dx, cy + dy, cz + dz);
+            bool seen = false;
+            for(unsigned k = 0; k < bucketCount; k++) seen |= buckets[k] == b;
+            if(!seen) buckets[bucketCount++] = b;
+          }
+        }
+      }
+
+      for(unsigned k = 0; k < bucketCount; k++) {
+        f(this->bucketStart[buckets[k]], this->bucketStart[buckets[k] + 1]);
+      }
+    }
+};
+
+
+#endif // _MPIGRAV_SPATIAL_HASH_INCLUDED
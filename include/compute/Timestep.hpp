@@ -0,0 +1,40 @@
+#ifndef _MPIGRAV_TIMESTEP_INCLUDED
+#define _MPIGRAV_TIMESTEP_INCLUDED
+
+
+// Internal
+#include "Master.hpp"
+
+
+// Largest factor the step may grow or shrink by between iterations
+#define _MPIGRAV_TIMESTEP_MAX_CHANGE 2.0f
+
+
+// Adaptive global timestep. The next step is picked from a courant-like
+// criterion on the largest acceleration (& jerk, if known) of any body,
+// estimated at the midpoint of the coming step so that a reversed run
+// would pick the same step, then rate limited & clamped to bounds.
+class TimestepController {
+  private:
+    float courant;        // Accuracy parameter, 0 = fixed timestep
+    float dtMin;
+    float dtMax;          // 0 = unbounded
+    float tauPrevious;    // Criterion at the last step, 0 = none yet
+
+  public:
+    TimestepController(
+      float const courant = 0, float const dtMin = 0, float const dtMax = 0);
+
+    bool Enabled(void) const { return this->courant > 0; }
+
+    // Next step given the current one, the softening length and the global
+    // maximum acceleration & jerk magnitudes (0 if not available)
+    float Next(
+      float const dt, float const e, float const aMax, float const jMax);
+
+    // Forget history, after bodies have been merged, added or removed
+    void Reset(void) { this->tauPrevious = 0; }
+};
+
+
+#endif // _MPIGRAV_TIMESTEP_INCLUDED
@@ -4,9 +4,12 @@
 
 // standard
 #include <vector>
+#include <string>
+#include <memory>
 
 
 // External
+#include "mpi.h"
 #define CL_HPP_ENABLE_EXCEPTIONS
 #define CL_HPP_TARGET_OPENCL_VERSION 200
 #include <CL/cl2.hpp>
@@ -16,25 +19,142 @@
 #include "Master.hpp"
 #include "util/Vec3.hpp"
 #include "Body.hpp"
+#include "compute/KernelTuner.hpp"
+#include "compute/ProgramCache.hpp"
+#include "compute/Numa.hpp"
+#include "compute/ParticleMesh.hpp"
+#include "compute/Integrators.hpp"
+#include "compute/Timestep.hpp"
+#include "compute/Morton.hpp"
+#include "compute/Density.hpp"
+#include "compute/Halos.hpp"
+#include "compute/ShortRange.hpp"
+#include "compute/SpatialHash.hpp"
+
+
+// Compute engines selectable at runtime
+typedef enum {
+  ENGINE_OPENCL,          // Opencl kernel
+  ENGINE_CPU,             // Openmp brute force
+  ENGINE_CPU_SYMMETRIC,   // Openmp brute force, each pair evaluated once
+  ENGINE_PM               // Particle-mesh fft, periodic boundaries
+} engine_t;
+
+engine_t ParseEngine(std::string const& str);
 
 
 // Kernel paths
 #define _MPIGRAV_LEAPGROG_KERNEL_PATH "kernels/leapfrog.cl"
 
 
+// Construction options which don't change during a run
+class UniverseConfig {
+  public:
+    std::string cacheDir;           // Tuning data & program binaries
+    hugepage_mode_t hugePages;      // Backing for integrator buffers
+    bool pinThreads;                // Pin openmp threads before first touch
+    bool overlapExchange;           // Hide position exchange behind compute
+    bool sharedMemory;              // One copy of the buffers per node
+    float collisionRadius;          // Merge bodies closer than this, 0 = off
+    unsigned reorderInterval;       // Steps between morton sorts, 0 = off
+    unsigned meshSize;              // Particle-mesh cells along each axis
+    float boxSize;                  // Particle-mesh periodic box edge length
+    integrator_t integrator;        // Time integration scheme
+    float courant;                  // Adaptive timestep accuracy, 0 = fixed
+    float dtMin;                    // Adaptive timestep bounds, 0 = none
+    float dtMax;
+    float cutoff;                   // Short range force cutoff, 0 = off
+    force_law_t forceLaw;           // Pair force inside the cutoff
+    float screeningLength;          // Decay length of the screened force
+    unsigned residentSteps;         // Device steps per host wait, 0 = off
+    MPI_Comm comm;                  // Ranks sharing the work
+
+  public:
+    UniverseConfig(void) :
+      cacheDir(_MPIGRAV_DEFAULT_CACHE_DIR),
+      hugePages(HUGEPAGES_TRANSPARENT),
+      pinThreads(false),
+      overlapExchange(false),
+      sharedMemory(false),
+      collisionRadius(0),
+      reorderInterval(0),
+      meshSize(64),
+      boxSize(4),
+      integrator(INTEGRATOR_LEAPFROG),
+      courant(0),
+      dtMin(0),
+      dtMax(0),
+      cutoff(0),
+      forceLaw(FORCE_TRUNCATED),
+      screeningLength(1),
+      residentSteps(0),
+      comm(MPI_COMM_WORLD) {}
+};
+
+bool SupportsIntegrator(engine_t const engine, UniverseConfig const& config);
+bool SupportsShortRange(engine_t const engine, UniverseConfig const& config);
+
+
+// Where the last step's time went, for monitoring
+class StepStats {
+  public:
+    double tChanges;          // Bodies added & removed
+    double tForces;           // Force evaluation & integration
+    double tCollisions;
+    double tReorder;
+    double tTimestep;         // Picking the next step size
+    double interactions;      // Pair forces on all ranks, direct sums only
+
+  public:
+    StepStats(void) :
+      tChanges(0), tForces(0), tCollisions(0), tReorder(0), tTimestep(0),
+      interactions(0) {}
+};
+
+
 class Universe {
   private:
-    // Which bodies this instance is responsible for
+    // Ranks sharing the work, see UniverseConfig
+    MPI_Comm comm;
+
+    // Which bodies this instance is responsible for, each rank's domain
+    // holds its share of the sources followed by its share of the tracers
     std::vector<unsigned> rankBodyCounts;
     std::vector<unsigned> rankBodyOffsets;
+    std::vector<unsigned> rankSourceCounts;
+
+    // Massless bodies are tracers, they feel the sources without pulling on
+    // anything & are never sent to other ranks. Sources are held as
+    // [start, end) pairs, one per run of domains without tracers between.
+    unsigned sourceCount;
+    unsigned tracerCount;
+    std::vector<unsigned> sourceRanges;
+
+    // Shared buffers, ranks on this node & one leader per node which takes
+    // part in the exchange of whole nodes' domains
+    MPI_Comm nodeComm;
+    MPI_Comm leaderComm;
+    MPI_Win nodeWindow;
+    std::vector<int> rankNodes;
+    std::vector<unsigned> nodeBodyCounts;
+    std::vector<unsigned> nodeBodyOffsets;
+
+    // Construction options
+    UniverseConfig config;
 
     // Simulation parameters
     float G;
     float dt;
     float e;
 
-    // Integrator term buffers
+    // Simulated time elapsed since construction
+    double simulationTime;
+
+    // Integrator term buffers, views into a single arena with room for
+    // capacity bodies, grown geometrically as bodies are added
     unsigned bodyCount;
+    unsigned capacity;
+    Arena storage;
     float* m;
     Vec3* r;
     Vec3* v;
@@ -42,14 +162,71 @@ class Universe {
     Vec3* rNext;
     Vec3* vNext;
     Vec3* aNext;
+    Vec3* j;
+    Vec3* jNext;
+
+    // Creation index of each stored body & storage index of each body in
+    // creation order, bodies are moved around by reordering, merging &
+    // runtime additions. Whether the two orders still match.
+    std::vector<unsigned> bodyIds;
+    std::vector<unsigned> bodyIndex;
+    bool storageOrdered;
+    unsigned createdCount;
+    unsigned stepsSinceReorder;
+
+    // Changes queued since the last step, see AddBody()
+    std::vector<Body> addedBodies;
+    std::vector<Vec3> addedVelocities;
+    std::vector<unsigned> removedIds;
+
+    // Whether a (& j) hold forces at the current state, see StepWith()
+    bool forcesPrimed;
+
+    // Force evaluations by Step() this step & the breakdown of the last one
+    unsigned forceEvaluations;
+    StepStats stepStats;
+
+    // Largest squared acceleration & jerk on this rank from the last force
+    // evaluation, reduced across ranks to pick the next timestep
+    TimestepController timestep;
+    float accelerationMax2;
+    float jerkMax2;
+
+    // Per-thread partial accelerations for the symmetric engine
+    std::vector<Vec3> threadAccumulators;
+
+    // In-flight position exchange, one request per rank's slice
+    std::vector<MPI_Request> exchangeRequests;
+    std::vector<int> landedSlices;
+
+    // Short range mode, sources received from other ranks for the last
+    // evaluation & the cell lists of every source within reach, in bucket
+    // order. Other ranks' bodies are only current within the halo.
+    std::vector<unsigned> haloBodies;
+    std::vector<float> cellMasses;
+    std::vector<Vec3> cellPositions;
+
+    // Particle-mesh solver, created on first use
+    std::unique_ptr<ParticleMesh> mesh;
 
     // OpenCL handles
     cl::Context clContext;
+    cl::Device clDevice;
     cl::CommandQueue clCommandQueue;
     cl::Program clProgram;
     cl::Kernel clKernel;
+    cl::Kernel clKernelAccumulate;
+    cl::Kernel clKernelIntegrate;
+    cl::Kernel clKernelCells;
+    KernelConfig clKernelConfig;
 
-    // OpenCL buffers
+    // Kernel source & compiled program cache
+    std::string clSource;
+    ProgramCache clProgramCache;
+
+    // OpenCL buffers, inputs hold capacity bodies & outputs hold
+    // domainCapacity, this rank's share
+    unsigned domainCapacity;
     cl::Buffer clBuf_m;
     cl::Buffer clBuf_r;
     cl::Buffer clBuf_v;
@@ -57,36 +234,179 @@ class Universe {
     cl::Buffer clBuf_rNext;
     cl::Buffer clBuf_vNext;
     cl::Buffer clBuf_aNext;
+    cl::Buffer clBuf_jNext;
+    cl::Buffer clBuf_aMax2;
+
+    // Single rank steps which stay on the device, see IterateResident().
+    // Host copies of the state are only fetched when something reads them.
+    bool hostStale;
+    bool deviceStale;
+    unsigned residentPending;
+
+    // Cell list buffers, grown as the lists do
+    unsigned cellCapacity;
+    unsigned cellTableCapacity;
+    cl::Buffer clBuf_cellM;
+    cl::Buffer clBuf_cellR;
+    cl::Buffer clBuf_cellStart;
 
 //====[METHODS]==============================================================//
 
     void InitCL(void);        // Initialises opencl stuff
+    void AllocateBuffersCL(void);
+
+    void DistributeWork(void);      // Assigns contiguous domains to ranks
+    void AssignDomains(
+      std::vector<unsigned> const& sourceCounts,
+      std::vector<unsigned> const& tracerCounts);
+
+    // Allocates integrator buffers, first touched by their compute threads
+    void AllocateStorage(void);
+
+    // Node shared buffers
+    void SplitNodes(void);
+    void* AllocateShared(size_t const bytes);
+    bool NodeLeader(void);
+    void NodeBarrier(void);
+
+    // Builds the kernel for a launch configuration & sets its arguments,
+    // tuning candidates bypass the program cache so only the winner is kept
+    void BuildKernel(KernelConfig const& config, bool const cached = true);
+    void BuildKernelNodeOrdered(KernelConfig const& config);
+    void SetKernelBufferArgs(void);
+    void SetKernelDomainArgs(void);
+    void WriteInputBuffers(void);
+    void ReadOutputBuffers(void);
+    unsigned GroupCount(void);
+    void EnqueueKernel(cl::Kernel const& kernel);
+    void EnqueueAccumulate(
+      unsigned const sourceStart, unsigned const sourceCount,
+      bool const overwrite);
+    bool FusedCL(void);
+    double BenchmarkKernel(KernelConfig const& config);
+
+    // Pieces of a split step, accelerations are unscaled until integration
+    void AccumulateLocal(void);
+    void AccumulateLocalSymmetric(void);
+    void AccumulateSlice(int const rank);
+    void IntegrateDomain(void);
+
+    // Integrator driven steps, see Integrators.hpp for the force functor
+    StepState State(void);
+    template<typename Forces> void Step(Forces& forces);
+    template<typename Integrator, typename Forces> void StepWith(Forces& f);
+    void ShareEvaluationPoints(Vec3* rEval, Vec3* vEval);
+    void EvaluateForces(Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut);
+    void EvaluateForcesCL(Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut);
+    template<bool jerk> void AccumulateForces(
+      Vec3 const* rEval, Vec3 const* vEval, Vec3* aOut, Vec3* jOut);
+
+    // Short range force evaluation over cell lists, see ShortRange.hpp
+    void ExchangeHalo(Vec3* rEval);
+    void BuildCells(Vec3 const* rEval, SpatialHash& cells);
+    void EvaluateShortRange(Vec3* rEval, Vec3* aOut, bool const useCL);
+    template<force_law_t law> void AccumulateShortRange(
+      SpatialHash const& cells, Vec3 const* rEval, Vec3* aOut);
+    void AccumulateShortRangeCL(
+      SpatialHash const& cells, Vec3 const* rEval, Vec3* aOut);
+    void ReserveCellBuffersCL(unsigned const count, unsigned const buckets);
+
+    // Whether steps can stay on the device & bringing the host up to date
+    bool Resident(engine_t const engine);
+    void FetchResident(void);
+
+    // Nonblocking position exchange
+    void BeginExchange(void);
+    void PollExchange(void);
+    int NextLandedSlice(void);
+    void FinishExchange(void);
+
+    // Choose the next timestep from the last force evaluation
+    void RecordDomainMax(void);
+    void AdaptTimestep(void);
+
+    // Collision detection & merging
+    std::vector<unsigned> FindCollisions(void);
+    unsigned MergeCollisions(void);
+    void MergeGroups(std::vector<unsigned> const& roots);
+
+    // Sorts bodies along a space filling curve for locality
+    void Reorder(void);
+    void IndexBodies(void);
+
+    // Applies queued additions & removals, growing buffers if needed
+    bool ApplyChanges(void);
 
     void SwapBuffers(void);   // Swaps intermediate buffers
+    void SwapBuffersCL(void);
     void Synchronize(void);   // Synchronizes buffers between processes
+    void AllgatherDomain(Vec3* buffer);
+    void AllgatherNodes(Vec3* buffer);
 
     unsigned GetDomainStart(void);
     unsigned GetDomainEnd(void);
     unsigned GetDomainSize(void);
+    unsigned GetDomainSourceEnd(void);
 
   public:
+    // Bodies are numbered in the order they're first stored, which is the
+    // order given unless there are tracers, see DistributeWork()
     Universe(
       std::vector<Body> const& bodyData,
-      float const G, float const dt, float const e);
+      float const G, float const dt, float const e,
+      UniverseConfig const& config = UniverseConfig());
+
+    // Owns its buffers & mpi handles, neither copied nor moved
+    Universe(Universe const&) = delete;
+    Universe& operator=(Universe const&) = delete;
+
+    // Collective, frees the node window & communicators, so every rank
+    // must destroy its universe before mpi is finalised
+    ~Universe(void);
 
     // Iteration routines
     double Iterate(void);     // Slow cpu code
+    double IterateSymmetric(void);    // Slow cpu code, but half as slow
     double IterateCL(void);   // Opencl kernel, woo, speedy
+    double IteratePM(void);   // Particle-mesh, periodic box
+    double IterateResident(void);     // Opencl, state stays on the device
+    double IterateOverlapped(engine_t const engine);
+    double Iterate(engine_t const engine);
 
-    // Gets content of the universe as vector of body classes
+    // Queue bodies to be added or removed (by id), the changes are applied
+    // together at the start of the next Iterate(engine). Every rank must
+    // queue the same changes. Added bodies take the next ids, returned here.
+    unsigned AddBody(Body const& body, Vec3 const velocity = Vec3(0, 0, 0));
+    void RemoveBody(unsigned const id);
+
+    // Selects kernel launch parameters, tuning and caching them if required
+    void TuneCL(tuning_mode_t const mode);
+
+    // Gets content of the universe as vector of body classes, in creation
+    // order whatever order they're stored in. Tracers added at runtime may
+    // be integrated by another rank than their share is read from.
     std::vector<Body> GetBodyData(void);
+    void GetDomainBodyData(std::vector<Body>& bodyData);
+    std::vector<unsigned> GetBodyIds(void);   // Same order, see RemoveBody()
+
+    // Velocities in the same order, current unless exchange is overlapped
+    std::vector<Vec3> GetVelocityData(void);
+    void GetDomainVelocityData(std::vector<Vec3>& velocityData);
+    double GetSimulationTime(void);
+    StepStats GetStepStats(void);
+
+    // Deposits this rank's domain into a density projection
+    void ProjectDensity(DensityProjection& projection);
+
+    // Friends-of-friends groups of the current positions, every rank must
+    // call this & every rank gets the catalogue
+    void FindHalos(HaloFinder& finder);
 
     // Sets for various simulation parameters
     void SetGravitationalConstant(float G);
     void SetTimestepSize(float dt);
+    float GetTimestepSize(void);
     void SetSofteningFactor(float e);
-
-    ~Universe(void);
 };
 
 
@@ -5,6 +5,7 @@
 #include <GLT/GL/Shader.hpp>
 
 #include "Body.hpp"
+#include "DensityImage.hpp"
 
 
 // Shader paths
@@ -19,5 +20,8 @@ GLT::ShaderProgram BuildBodyShader(void);
 // Generate a mesh from a list of bodies
 GLT::Mesh MakeMeshFromBodyList(std::vector<Body> const& bodies);
 
+// Generate a mesh of points in the x-y plane from a density image
+GLT::Mesh MakeMeshFromDensity(DensityImage const& image);
+
 
 #endif // _MPIGRAV_DRAW_INCLUDED
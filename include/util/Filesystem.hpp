@@ -0,0 +1,45 @@
+#ifndef _MPIGRAV_FILESYSTEM_INCLUDED
+#define _MPIGRAV_FILESYSTEM_INCLUDED
+
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "Master.hpp"
+
+
+// Expand a leading ~ to the user's home directory
+inline std::string ExpandPath(std::string const& path) {
+  if(path.empty() || path[0] != '~') return path;
+  char const* home = getenv("HOME");
+  if(!home) return path;
+  return std::string(home) + path.substr(1);
+}
+
+
+// Create a directory and any missing parents, returns true on success
+inline bool MakeDirectories(std::string const& path) {
+  for(size_t i = 1; i <= path.size(); i++) {
+    if(i == path.size() || path[i] == '/') {
+      std::string dir = path.substr(0, i);
+      if(mkdir(dir.c_str(), 0755) && errno != EEXIST) return false;
+    }
+  }
+  return true;
+}
+
+
+// Directory containing the running executable, falls back to the cwd
+inline std::string ExecutableDirectory(void) {
+  char buf[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  if(len <= 0) return ".";
+  std::string path(buf, len);
+  return path.substr(0, path.rfind('/'));
+}
+
+
+#endif // _MPIGRAV_FILESYSTEM_INCLUDED
@@ -90,6 +90,12 @@ inline Vec3 Normalize(Vec3 lhs) {
 }
 
 
+// Dot product
+inline float Dot(Vec3 const& lhs, Vec3 const& rhs) {
+  return lhs.x*rhs.x + lhs.y*rhs.y + lhs.z*rhs.z;
+}
+
+
 // Get magnitude of vector
 inline float Magnitude(Vec3 const& lhs) {
   return sqrt(lhs.x*lhs.x + lhs.y*lhs.y + lhs.z*lhs.z);
@@ -83,9 +83,11 @@ int main(int argc, char **argv) {
 //====[TEMPORARY]============================================================//
 
 
-    // Get body data and draw
-    std::vector<Body> bodies = client.GetBodyData();
-    GLT::Mesh bodyMesh = MakeMeshFromBodyList(bodies);
+    // Get body data or the density image, whichever is streamed, and draw
+    DensityImage density = client.GetDensityData();
+    GLT::Mesh bodyMesh = density.resolution ?
+      MakeMeshFromDensity(density) :
+      MakeMeshFromBodyList(client.GetExtrapolatedBodyData());
     glm::mat4 m = glm::mat4(1.0f);
     window.Draw(bodyMesh, bodyShader, m);
     window.Refresh();
@@ -3,37 +3,96 @@ using namespace boost::asio;
 using ip::tcp;
 
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+
+// Largest read while throttled, keeps the rate smooth
+#define _MPIGRAV_THROTTLED_READ_SIZE 4096
 
 
 // Constructor attempts a connection
-Client::Client(std::string const host, int const port) :
+Client::Client(std::string const host, int const port, bool const verbose) :
   socket(tcp::socket(this->ioService)) {
 
-  std::cout << "Connecting to: " << host << ":" << port << "\n";
+  if(verbose) std::cout << "Connecting to: " << host << ":" << port << "\n";
   this->socket.connect(tcp::endpoint(ip::address::from_string(host), port));
   socket.set_option(tcp::no_delay(true));
 
+  this->readRate = 0;
   this->done = false;
+  this->frameSimulationTime = 0;
+  this->frameReceived = 0;
+  this->frameInterval = 0;
+  this->frameTimestep = 0;
+  this->simulationRate = 0;
   this->signalListenerThread =
     std::thread(&Client::SignalListenerMain, this);
 }
 
 
+// Disconnect, unblocking the listener thread
+Client::~Client(void) {
+  this->done = true;
+  boost::system::error_code err;
+  this->socket.shutdown(tcp::socket::shutdown_both, err);
+  if(this->signalListenerThread.joinable()) {
+    this->signalListenerThread.join();
+  }
+}
+
+
 // Signal listener thread
 void Client::SignalListenerMain(void) {
-  while(!this->done) {
-    switch(this->RecvSignal()) {
-      case SIGNAL_TRANSMIT_BODY_DATA:
-        this->RecvBodyData();
-        break;
-      case SIGNAL_CLIENT_DISCONNECT:
-        this->done = true;
-        break;
-      default:
-        std::cout << "Error, unrecognised signal from server, disconnecting\n";
-        this->done = true;
-        break;
+  try {
+    while(!this->done) {
+      switch(this->RecvSignal()) {
+        case SIGNAL_TRANSMIT_BODY_DATA:
+          this->RecvBodyData();
+          break;
+        case SIGNAL_TRANSMIT_BODY_MOTION:
+          this->RecvBodyMotion();
+          break;
+        case SIGNAL_TRANSMIT_DENSITY_DATA:
+          this->RecvDensityData();
+          break;
+        case SIGNAL_CLIENT_DISCONNECT:
+          this->done = true;
+          break;
+        default:
+          std::cout << "Error, unrecognised signal from server, ";
+          std::cout << "disconnecting\n";
+          this->done = true;
+          break;
+      }
     }
+  } catch(std::exception& e) {
+    if(!this->done) std::cout << "Connection error: " << e.what() << "\n";
+    this->done = true;
+  }
+}
+
+
+// Read from the server, paced to the read rate if one is set
+void Client::Recv(void* data, size_t const size) {
+  double rate = this->readRate;
+  if(rate <= 0) {
+    read(this->socket, buffer(data, size));
+    return;
+  }
+
+  using namespace std::chrono;
+  char* p = (char*)data;
+  size_t remaining = size;
+  while(remaining) {
+    size_t chunk = std::min(remaining, (size_t)_MPIGRAV_THROTTLED_READ_SIZE);
+    high_resolution_clock::time_point tStart = high_resolution_clock::now();
+    read(this->socket, buffer(p, chunk));
+    std::this_thread::sleep_until(tStart + duration<double>(chunk / rate));
+    p += chunk;
+    remaining -= chunk;
   }
 }
 
@@ -41,7 +100,7 @@ void Client::SignalListenerMain(void) {
 // Send a request to the server
 signal_t Client::RecvSignal(void) {
   signal_t sig;
-  read(this->socket, buffer(&sig, sizeof(signal_t)));
+  this->Recv(&sig, sizeof(signal_t));
   return sig;
 }
 
@@ -49,21 +108,144 @@ signal_t Client::RecvSignal(void) {
 // Get integer from server
 int Client::RecvInt(void) {
   int i;
-  read(this->socket, buffer(&i, sizeof(int)));
+  this->Recv(&i, sizeof(int));
   return i;
 }
 
 
+// Get double from server
+double Client::RecvDouble(void) {
+  double d;
+  this->Recv(&d, sizeof(double));
+  return d;
+}
+
+
+// Get float from server
+float Client::RecvFloat(void) {
+  float f;
+  this->Recv(&f, sizeof(float));
+  return f;
+}
+
+
 // Get body data from server
 void Client::RecvBodyData(void) {
   unsigned n = this->RecvInt();
+  double timestamp = this->RecvDouble();
   std::vector<Body> buf(n);
-  read(this->socket, buffer(buf.data(), n * sizeof(Body)));
+  this->Recv(buf.data(), n * sizeof(Body));
+  double latency = WallClock() - timestamp;
 
   // Update local buffer
   this->bodyDataMutex.lock();
   this->bodyData = buf;
   this->bodyDataMutex.unlock();
+
+  // Update statistics
+  this->statsMutex.lock();
+  this->stats.frames++;
+  this->stats.bytes +=
+    sizeof(signal_t) + sizeof(int) + sizeof(double) + (n * sizeof(Body));
+  this->stats.latencySum += latency;
+  this->stats.latencyMax = std::max(this->stats.latencyMax, latency);
+  this->stats.latencyIntervalMax =
+    std::max(this->stats.latencyIntervalMax, latency);
+  this->statsMutex.unlock();
+}
+
+
+// Get bodies with velocities & the simulation clock from the server, the
+// pace of the simulation is measured between consecutive frames
+void Client::RecvBodyMotion(void) {
+  unsigned n = this->RecvInt();
+  double timestamp = this->RecvDouble();
+  double simulationTime = this->RecvDouble();
+  float timestep = this->RecvFloat();
+  std::vector<Body> buf(n);
+  std::vector<Vec3> velocities(n);
+  this->Recv(buf.data(), n * sizeof(Body));
+  this->Recv(velocities.data(), n * sizeof(Vec3));
+  double received = WallClock();
+  double latency = received - timestamp;
+
+  // Update local buffer, the server repeats frames until the simulation
+  // moves on & repeats mustn't reset the extrapolation
+  this->bodyDataMutex.lock();
+  double elapsed = simulationTime - this->frameSimulationTime;
+  bool repeat = this->frameReceived > 0 && elapsed == 0;
+  bool paced = this->frameReceived > 0 && received > this->frameReceived;
+  if(paced && elapsed > 0) {
+    this->simulationRate = elapsed / (received - this->frameReceived);
+    this->frameInterval = elapsed;
+  } else if(elapsed < 0) {
+    this->simulationRate = 0;
+    this->frameInterval = 0;
+  }
+  if(!repeat) this->frameReceived = received;
+  this->bodyData = buf;
+  this->velocityData = velocities;
+  this->frameSimulationTime = simulationTime;
+  this->frameTimestep = timestep;
+  this->bodyDataMutex.unlock();
+
+  // Update statistics
+  this->statsMutex.lock();
+  this->stats.frames++;
+  this->stats.bytes += sizeof(signal_t) + sizeof(int) +
+    (2 * sizeof(double)) + sizeof(float) +
+    (n * (sizeof(Body) + sizeof(Vec3)));
+  this->stats.latencySum += latency;
+  this->stats.latencyMax = std::max(this->stats.latencyMax, latency);
+  this->stats.latencyIntervalMax =
+    std::max(this->stats.latencyIntervalMax, latency);
+  this->statsMutex.unlock();
+}
+
+
+// Get a compressed density image from the server
+void Client::RecvDensityData(void) {
+  DensityImage image;
+  image.resolution = this->RecvInt();
+  image.extent = this->RecvFloat();
+  double timestamp = this->RecvDouble();
+  unsigned n = this->RecvInt();
+
+  // Sizes come off the wire, only a complete image in bounds is kept
+  if(image.resolution > _MPIGRAV_MAX_DENSITY_RESOLUTION) {
+    throw std::runtime_error("Corrupt density image");
+  }
+  uLongf expected = image.resolution * image.resolution;
+  if(n > compressBound(expected)) {
+    throw std::runtime_error("Corrupt density image");
+  }
+
+  std::vector<uint8_t> compressed(n);
+  this->Recv(compressed.data(), n);
+  double latency = WallClock() - timestamp;
+
+  uLongf size = expected;
+  image.pixels.resize(size);
+  if(uncompress(image.pixels.data(), &size, compressed.data(), n) != Z_OK ||
+     size != expected) {
+    throw std::runtime_error("Corrupt density image");
+  }
+
+  // Update local buffer
+  this->bodyDataMutex.lock();
+  this->densityData = image;
+  this->bodyDataMutex.unlock();
+
+  // Update statistics
+  this->statsMutex.lock();
+  this->stats.frames++;
+  this->stats.bytes += sizeof(signal_t) + (2 * sizeof(int)) +
+    sizeof(float) + sizeof(double) + n;
+  this->stats.latencySum += latency;
+  this->stats.latencyMax = std::max(this->stats.latencyMax, latency);
+  this->stats.latencyIntervalMax =
+    std::max(this->stats.latencyIntervalMax, latency);
+  this->statsMutex.unlock();
 }
 
 
@@ -74,3 +256,58 @@ std::vector<Body> Client::GetBodyData(void) {
   this->bodyDataMutex.unlock();
   return buf;
 }
+
+
+// Bodies advanced along their velocities to the present, assuming the
+// simulation keeps the pace of the last two frames. Extrapolation stops
+// one frame ahead so that a stalled server doesn't fling bodies away.
+std::vector<Body> Client::GetExtrapolatedBodyData(void) {
+  this->bodyDataMutex.lock();
+  std::vector<Body> buf = this->bodyData;
+  std::vector<Vec3> velocities = this->velocityData;
+  double ahead = (WallClock() - this->frameReceived) * this->simulationRate;
+  double horizon = std::max(this->frameInterval, (double)this->frameTimestep);
+  this->bodyDataMutex.unlock();
+
+  float t = std::min(ahead, horizon);
+  if(t <= 0 || velocities.size() != buf.size()) return buf;
+
+  Body* b = buf.data();
+  Vec3 const* u = velocities.data();
+  unsigned n = buf.size();
+
+  #pragma omp simd
+  for(unsigned i = 0; i < n; i++) {
+    b[i].r.x += u[i].x * t;
+    b[i].r.y += u[i].y * t;
+    b[i].r.z += u[i].z * t;
+  }
+  return buf;
+}
+
+
+DensityImage Client::GetDensityData(void) {
+  this->bodyDataMutex.lock();
+  DensityImage image = this->densityData;
+  this->bodyDataMutex.unlock();
+  return image;
+}
+
+
+void Client::SetReadRate(double const bytesPerSecond) {
+  this->readRate = bytesPerSecond;
+}
+
+
+ClientStats Client::GetStats(bool const newInterval) {
+  this->statsMutex.lock();
+  ClientStats s = this->stats;
+  if(newInterval) this->stats.latencyIntervalMax = 0;
+  this->statsMutex.unlock();
+  return s;
+}
+
+
+bool Client::Connected(void) {
+  return !this->done;
+}
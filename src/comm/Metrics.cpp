@@ -0,0 +1,290 @@
+#include "comm/Metrics.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+
+#include <boost/asio.hpp>
+
+using namespace boost::asio;
+using ip::tcp;
+
+
+// Largest request header read before answering
+#define _MPIGRAV_METRICS_MAX_REQUEST 8192
+
+// Seconds a client gets to send its request before it's dropped
+#define _MPIGRAV_METRICS_REQUEST_TIMEOUT 5
+
+
+//====[HISTOGRAM]============================================================//
+
+// 1, 2.5, 5 steps per decade
+static std::vector<double> DurationBounds(void) {
+  std::vector<double> bounds;
+  for(double decade = 1e-5; decade < 100; decade *= 10) {
+    bounds.push_back(decade);
+    bounds.push_back(decade * 2.5);
+    bounds.push_back(decade * 5);
+  }
+  bounds.push_back(100);
+  return bounds;
+}
+
+
+Histogram::Histogram(void) : Histogram(DurationBounds()) {}
+
+
+Histogram::Histogram(std::vector<double> const& bounds) :
+  bounds(bounds),
+  counts(new std::atomic<uint64_t>[bounds.size() + 1]),
+  sum(0) {
+
+  for(unsigned k = 0; k <= this->bounds.size(); k++) this->counts[k] = 0;
+}
+
+
+void Histogram::Observe(double const x) {
+  unsigned k =
+    std::lower_bound(this->bounds.begin(), this->bounds.end(), x) -
+    this->bounds.begin();
+  this->counts[k].fetch_add(1, std::memory_order_relaxed);
+
+  double s = this->sum.load(std::memory_order_relaxed);
+  while(!this->sum.compare_exchange_weak(
+    s, s + x, std::memory_order_relaxed)) {}
+}
+
+
+// Buckets are cumulative in the exposition format
+void Histogram::Write(
+  std::ostream& out,
+  std::string const& name,
+  std::string const& labels) const {
+
+  std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t total = 0;
+  for(unsigned k = 0; k <= this->bounds.size(); k++) {
+    total += this->counts[k].load(std::memory_order_relaxed);
+    out << name << "_bucket{" << prefix << "le=\"";
+    if(k < this->bounds.size()) out << this->bounds[k];
+    else out << "+Inf";
+    out << "\"} " << total << "\n";
+  }
+  std::string braces = labels.empty() ? "" : "{" + labels + "}";
+  out << name << "_sum" << braces << " ";
+  out << this->sum.load(std::memory_order_relaxed) << "\n";
+  out << name << "_count" << braces << " " << total << "\n";
+}
+
+
+//====[METRICS]==============================================================//
+
+Metrics::Metrics(void) {
+  this->port = 0;
+  this->done = false;
+  this->clientsCreated = 0;
+}
+
+
+void Metrics::Start(int const port) {
+  this->port = port;
+  this->listenerThread = std::thread(&Metrics::ListenerMain, this);
+}
+
+
+std::shared_ptr<ClientMetrics> Metrics::AddClient(
+  std::string const& address) {
+
+  std::shared_ptr<ClientMetrics> client(new ClientMetrics);
+  client->address = address;
+
+  this->clientsMutex.lock();
+  client->id = this->clientsCreated++;
+  this->clients.push_back(client);
+  this->clientsMutex.unlock();
+  return client;
+}
+
+
+static void WriteHeader(
+  std::ostream& out,
+  std::string const& name,
+  std::string const& type,
+  std::string const& help) {
+
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " " << type << "\n";
+}
+
+
+std::string Metrics::Render(void) {
+  static char const* phaseNames[PHASE_COUNT] = {
+    "changes", "forces", "collisions", "reorder", "timestep", "output",
+    "halos"};
+
+  std::ostringstream out;
+  out.precision(10);
+
+  WriteHeader(out, "mpigrav_steps_total", "counter", "Steps taken");
+  out << "mpigrav_steps_total " << this->steps.Value() << "\n";
+  WriteHeader(out, "mpigrav_interactions_total", "counter",
+    "Pair forces evaluated, direct summation only");
+  out << "mpigrav_interactions_total " << this->interactions.Value() << "\n";
+  WriteHeader(out, "mpigrav_steps_per_second", "gauge",
+    "Step rate over the last step");
+  out << "mpigrav_steps_per_second " << this->stepRate.Value() << "\n";
+  WriteHeader(out, "mpigrav_interactions_per_second", "gauge",
+    "Pair force rate over the last step");
+  out << "mpigrav_interactions_per_second ";
+  out << this->interactionRate.Value() << "\n";
+  WriteHeader(out, "mpigrav_simulation_time", "gauge",
+    "Simulated time elapsed");
+  out << "mpigrav_simulation_time " << this->simulationTime.Value() << "\n";
+
+  WriteHeader(out, "mpigrav_step_seconds", "histogram",
+    "Wall time per step, including output");
+  this->stepTime.Write(out, "mpigrav_step_seconds", "");
+  WriteHeader(out, "mpigrav_phase_seconds", "histogram",
+    "Wall time per step spent in each phase");
+  for(unsigned k = 0; k < PHASE_COUNT; k++) {
+    this->phaseTime[k].Write(
+      out, "mpigrav_phase_seconds",
+      std::string("phase=\"") + phaseNames[k] + "\"");
+  }
+
+  WriteHeader(out, "mpigrav_clients", "gauge", "Connected viewers");
+  out << "mpigrav_clients " << this->clientCount.Value() << "\n";
+  WriteHeader(out, "mpigrav_frames_sent_total", "counter",
+    "Frames written to viewers");
+  out << "mpigrav_frames_sent_total " << this->framesSent.Value() << "\n";
+  WriteHeader(out, "mpigrav_sent_bytes_total", "counter",
+    "Bytes written to viewers");
+  out << "mpigrav_sent_bytes_total " << this->bytesSent.Value() << "\n";
+  WriteHeader(out, "mpigrav_client_lag_seconds", "histogram",
+    "Frame taken to frame written, per frame & viewer");
+  this->clientLag.Write(out, "mpigrav_client_lag_seconds", "");
+
+  // Per viewer series come & go with their connections
+  std::ostringstream lag, frames, bytes;
+  lag.precision(10);
+  this->clientsMutex.lock();
+  auto i = this->clients.begin();
+  while(i != this->clients.end()) {
+    std::shared_ptr<ClientMetrics> client = i->lock();
+    if(!client) {
+      this->clients.erase(i++);
+      continue;
+    }
+    std::ostringstream labels;
+    labels << "{client=\"" << client->id << "\",address=\"";
+    labels << client->address << "\"} ";
+    lag << "mpigrav_client_last_lag_seconds" << labels.str();
+    lag << client->lag.Value() << "\n";
+    frames << "mpigrav_client_frames_total" << labels.str();
+    frames << client->frames.Value() << "\n";
+    bytes << "mpigrav_client_sent_bytes_total" << labels.str();
+    bytes << client->bytes.Value() << "\n";
+    i++;
+  }
+  this->clientsMutex.unlock();
+
+  WriteHeader(out, "mpigrav_client_last_lag_seconds", "gauge",
+    "Lag of the last frame written to each viewer");
+  out << lag.str();
+  WriteHeader(out, "mpigrav_client_frames_total", "counter",
+    "Frames written to each viewer");
+  out << frames.str();
+  WriteHeader(out, "mpigrav_client_sent_bytes_total", "counter",
+    "Bytes written to each viewer");
+  out << bytes.str();
+
+  return out.str();
+}
+
+
+// Reads the request header, closing the socket if it hasn't arrived by
+// the deadline so an idle client can't hold up later scrapes
+static void ReadRequest(
+  io_service& ioService, tcp::socket& socket, streambuf& request) {
+
+  boost::system::error_code readError = error::timed_out;
+  steady_timer timer(ioService);
+  timer.expires_from_now(
+    std::chrono::seconds(_MPIGRAV_METRICS_REQUEST_TIMEOUT));
+  timer.async_wait([&](boost::system::error_code const& e) {
+    if(!e) socket.close();
+  });
+  async_read_until(socket, request, "\r\n\r\n",
+    [&](boost::system::error_code const& e, std::size_t) {
+      readError = e;
+      timer.cancel();
+    });
+
+  ioService.restart();
+  ioService.run();
+  if(readError) throw boost::system::system_error(readError);
+}
+
+
+// One request per connection, anything but /metrics gets a 404
+void Metrics::ListenerMain(void) {
+  try {
+    io_service ioService;
+    tcp::acceptor acceptor(
+      ioService, tcp::endpoint(ip::address_v4::loopback(), this->port));
+
+    std::cout << "Serving metrics on port: " << this->port << "\n";
+    while(!this->done) {
+
+      // The destructor connects to wake us
+      tcp::socket socket(ioService);
+      acceptor.accept(socket);
+      if(this->done) break;
+
+      try {
+        streambuf request(_MPIGRAV_METRICS_MAX_REQUEST);
+        ReadRequest(ioService, socket, request);
+        std::istream requestStream(&request);
+        std::string method, path;
+        requestStream >> method >> path;
+
+        std::string status = "200 OK";
+        std::string body;
+        if(method != "GET") {
+          status = "405 Method Not Allowed";
+        } else if(path != "/metrics") {
+          status = "404 Not Found";
+        } else {
+          body = this->Render();
+        }
+
+        std::ostringstream response;
+        response << "HTTP/1.1 " << status << "\r\n";
+        response << "Content-Type: text/plain; version=0.0.4\r\n";
+        response << "Content-Length: " << body.size() << "\r\n";
+        response << "Connection: close\r\n\r\n" << body;
+        write(socket, buffer(response.str()));
+      } catch(std::exception& e) {}
+    }
+  } catch(std::exception const& e) {
+    std::cout << "Metrics listener error: " << e.what() << "\n";
+  }
+}
+
+
+// The listener is blocked in accept, connect to it once so it sees that
+// we're done
+Metrics::~Metrics(void) {
+  this->done = true;
+
+  if(this->listenerThread.joinable()) {
+    try {
+      io_service ioService;
+      tcp::socket socket(ioService);
+      socket.connect(tcp::endpoint(ip::address_v4::loopback(), this->port));
+    } catch(std::exception& e) {}
+    this->listenerThread.join();
+  }
+}
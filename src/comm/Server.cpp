@@ -3,6 +3,9 @@
 #include <iostream>
 #include <memory>
 #include <chrono>
+#include <sstream>
+
+#include <zlib.h>
 
 using namespace boost::asio;
 using ip::tcp;
@@ -15,6 +18,13 @@ Server::Server(std::vector<Body> const& bodyData) {
   this->bodyData = bodyData;
   this->bodyDataMutex.unlock();
   this->done = false;
+  this->bodyFrame = nullptr;
+  this->bodyFrameCount = 0;
+  this->streamDensity = false;
+  this->streamMotion = false;
+  this->simulationTime = 0;
+  this->timestep = 0;
+  this->metrics = nullptr;
 }
 
 
@@ -33,6 +43,11 @@ void Server::Start(int const port, double const updateFrequency) {
 }
 
 
+void Server::SetMetrics(Metrics* metrics) {
+  this->metrics = metrics;
+}
+
+
 // Client listener thread
 void Server::ConnectionListenerMain(void) {
   try {
@@ -42,15 +57,28 @@ void Server::ConnectionListenerMain(void) {
     std::cout << "Listening for connections on port: " << this->port << "\n";
     while(!this->done) {
 
-      // Wait for someone to connect
+      // Wait for someone to connect, the destructor connects to wake us
       std::shared_ptr<tcp::socket> socket(new tcp::socket(ioService));
       acceptor.accept(*socket);
+      if(this->done) break;
       socket->set_option(tcp::no_delay(true));
       std::cout << "Client connected!\n";
 
+      Connection connection;
+      connection.socket = socket;
+      if(this->metrics) {
+        boost::system::error_code err;
+        std::ostringstream address;
+        address << socket->remote_endpoint(err);
+        connection.metrics = this->metrics->AddClient(address.str());
+      }
+
       // Create a new client thread
       this->socketListMutex.lock();
-      this->sockets.push_back(socket);
+      this->connections.push_back(connection);
+      if(this->metrics) {
+        this->metrics->clientCount.Set(this->connections.size());
+      }
       this->socketListMutex.unlock();
     }
   } catch(const std::exception& e) {
@@ -59,58 +87,184 @@ void Server::ConnectionListenerMain(void) {
 }
 
 
-void Server::SendSignal(
+size_t Server::SendSignal(
   std::shared_ptr<ip::tcp::socket> socket,
   signal_t sig) {
 
-  write(*socket, buffer(&sig, sizeof(signal_t)));
+  return write(*socket, buffer(&sig, sizeof(signal_t)));
 }
 
 
-void Server::SendInt(
+size_t Server::SendInt(
   std::shared_ptr<boost::asio::ip::tcp::socket> socket,
   int i) {
 
-  write(*socket, buffer(&i, sizeof(int)));
+  return write(*socket, buffer(&i, sizeof(int)));
+}
+
+
+size_t Server::SendDouble(
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+  double d) {
+
+  return write(*socket, buffer(&d, sizeof(double)));
+}
+
+
+size_t Server::SendFloat(
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+  float f) {
+
+  return write(*socket, buffer(&f, sizeof(float)));
 }
 
 
-void Server::SendBodyData(
+// Frame layout: signal, body count, timestamp, bodies
+size_t Server::SendBodyData(
   std::shared_ptr<ip::tcp::socket> socket,
-  std::vector<Body> const& buf) {
+  Body const* bodies,
+  unsigned const count,
+  double const timestamp) {
 
-  this->SendSignal(socket, SIGNAL_TRANSMIT_BODY_DATA);
-  this->SendInt(socket, buf.size());
-  write(*socket, buffer(buf.data(), buf.size() * sizeof(Body)));
+  size_t bytes = this->SendSignal(socket, SIGNAL_TRANSMIT_BODY_DATA);
+  bytes += this->SendInt(socket, count);
+  bytes += this->SendDouble(socket, timestamp);
+  bytes += write(*socket, buffer(bodies, count * sizeof(Body)));
+  return bytes;
 }
 
 
-// Update connected clients, return true on success
-void Server::UpdateClients(std::vector<Body> const& buf) {
+// Frame layout: signal, body count, timestamp, simulation time, timestep,
+// bodies, velocities
+size_t Server::SendBodyMotion(
+  std::shared_ptr<ip::tcp::socket> socket,
+  std::vector<Body> const& buf,
+  std::vector<Vec3> const& velocities,
+  double const simulationTime,
+  float const timestep,
+  double const timestamp) {
+
+  size_t bytes = this->SendSignal(socket, SIGNAL_TRANSMIT_BODY_MOTION);
+  bytes += this->SendInt(socket, buf.size());
+  bytes += this->SendDouble(socket, timestamp);
+  bytes += this->SendDouble(socket, simulationTime);
+  bytes += this->SendFloat(socket, timestep);
+  bytes += write(*socket, buffer(buf.data(), buf.size() * sizeof(Body)));
+  bytes += write(
+    *socket, buffer(velocities.data(), velocities.size() * sizeof(Vec3)));
+  return bytes;
+}
+
+
+// Frame layout: signal, resolution, extent, timestamp, compressed size,
+// zlib compressed pixels
+size_t Server::SendDensityData(
+  std::shared_ptr<ip::tcp::socket> socket,
+  DensityImage const& image,
+  std::vector<uint8_t> const& compressed,
+  double const timestamp) {
+
+  size_t bytes = this->SendSignal(socket, SIGNAL_TRANSMIT_DENSITY_DATA);
+  bytes += this->SendInt(socket, image.resolution);
+  bytes += this->SendFloat(socket, image.extent);
+  bytes += this->SendDouble(socket, timestamp);
+  bytes += this->SendInt(socket, compressed.size());
+  bytes += write(*socket, buffer(compressed.data(), compressed.size()));
+  return bytes;
+}
+
+
+// Send to every connected client, dropping those which fail. Lag is from
+// the frame being taken to it being written, so includes time queued
+// behind other clients.
+template<typename Send>
+void Server::ForEachClient(Send const& send, double const timestamp) {
   this->socketListMutex.lock();
-  auto i = this->sockets.cbegin();
-  while(i != this->sockets.cend()) {
+  auto i = this->connections.cbegin();
+  while(i != this->connections.cend()) {
     try {
-      this->SendBodyData(*i, buf);
+      size_t bytes = send(i->socket);
+      if(this->metrics) {
+        double lag = WallClock() - timestamp;
+        this->metrics->framesSent.Add();
+        this->metrics->bytesSent.Add(bytes);
+        this->metrics->clientLag.Observe(lag);
+        i->metrics->frames.Add();
+        i->metrics->bytes.Add(bytes);
+        i->metrics->lag.Set(lag);
+      }
       i++;
     } catch(std::exception& e) {
       std::cout << "Client socket error, disconnecting\n";
-      this->sockets.erase(i++);
+      this->connections.erase(i++);
     }
   }
+  if(this->metrics) this->metrics->clientCount.Set(this->connections.size());
   this->socketListMutex.unlock();
 }
 
 
+// Update connected clients
+void Server::UpdateClients(
+  std::vector<Body> const& buf,
+  double const timestamp) {
+
+  this->ForEachClient([&](std::shared_ptr<tcp::socket> socket) {
+    return this->SendBodyData(socket, buf.data(), buf.size(), timestamp);
+  }, timestamp);
+}
+
+
 void Server::ClientUpdateMain(void) {
   using namespace std::chrono;
   while(!this->done) {
     high_resolution_clock::time_point tStart = high_resolution_clock::now();
 
+    // Frames are stamped when taken, so latency includes time queued
+    // behind other clients
     this->bodyDataMutex.lock();
-    std::vector<Body> buf = this->bodyData;
-    this->bodyDataMutex.unlock();
-    this->UpdateClients(buf);
+    if(this->streamDensity) {
+      DensityImage image = this->densityData;
+      this->bodyDataMutex.unlock();
+      double timestamp = WallClock();
+
+      // Compressed once for everyone, favouring speed
+      uLongf size = compressBound(image.pixels.size());
+      std::vector<uint8_t> compressed(size);
+      compress2(
+        compressed.data(), &size, image.pixels.data(), image.pixels.size(),
+        Z_BEST_SPEED);
+      compressed.resize(size);
+
+      this->ForEachClient([&](std::shared_ptr<tcp::socket> socket) {
+        return this->SendDensityData(socket, image, compressed, timestamp);
+      }, timestamp);
+    } else if(this->streamMotion) {
+      std::vector<Body> buf = this->bodyData;
+      std::vector<Vec3> velocities = this->velocityData;
+      double simulationTime = this->simulationTime;
+      float timestep = this->timestep;
+      this->bodyDataMutex.unlock();
+      double timestamp = WallClock();
+
+      this->ForEachClient([&](std::shared_ptr<tcp::socket> socket) {
+        return this->SendBodyMotion(
+          socket, buf, velocities, simulationTime, timestep, timestamp);
+      }, timestamp);
+    } else if(this->bodyFrame) {
+      Body const* bodies = this->bodyFrame;
+      unsigned count = this->bodyFrameCount;
+      this->bodyDataMutex.unlock();
+      double timestamp = WallClock();
+
+      this->ForEachClient([&](std::shared_ptr<tcp::socket> socket) {
+        return this->SendBodyData(socket, bodies, count, timestamp);
+      }, timestamp);
+    } else {
+      std::vector<Body> buf = this->bodyData;
+      this->bodyDataMutex.unlock();
+      this->UpdateClients(buf, WallClock());
+    }
 
     std::this_thread::sleep_until(
       duration<double>(1 / this->updateFrequency) + tStart);
@@ -124,3 +278,55 @@ void Server::SetBodyData(std::vector<Body> const& bodyData) {
   this->bodyData = bodyData;
   this->bodyDataMutex.unlock();
 }
+
+
+// Send velocities & the simulation clock with bodies from now on
+void Server::SetBodyData(
+  std::vector<Body> const& bodyData,
+  std::vector<Vec3> const& velocityData,
+  double const simulationTime,
+  float const timestep) {
+
+  this->bodyDataMutex.lock();
+  this->bodyData = bodyData;
+  this->velocityData = velocityData;
+  this->simulationTime = simulationTime;
+  this->timestep = timestep;
+  this->streamMotion = true;
+  this->bodyDataMutex.unlock();
+}
+
+
+// Stream a density image instead of bodies from now on
+void Server::SetDensityData(DensityImage const& densityData) {
+  this->bodyDataMutex.lock();
+  this->densityData = densityData;
+  this->streamDensity = true;
+  this->bodyDataMutex.unlock();
+}
+
+
+// Nothing is copied, a frame may still be going out after the next is set
+void Server::SetBodyFrame(Body const* bodies, unsigned const count) {
+  this->bodyDataMutex.lock();
+  this->bodyFrame = bodies;
+  this->bodyFrameCount = count;
+  this->bodyDataMutex.unlock();
+}
+
+
+// The listener is blocked in accept, so connect to it once to let it see
+// that we're done
+Server::~Server(void) {
+  this->done = true;
+
+  if(this->connectionListenerThread.joinable()) {
+    try {
+      io_service ioService;
+      tcp::socket socket(ioService);
+      socket.connect(tcp::endpoint(ip::address_v4::loopback(), this->port));
+    } catch(std::exception& e) {}
+    this->connectionListenerThread.join();
+  }
+  if(this->clientUpdateThread.joinable()) this->clientUpdateThread.join();
+}
@@ -0,0 +1,95 @@
+#include "comm/Trajectory.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//====[WRITER]===============================================================//
+
+TrajectoryWriter::TrajectoryWriter(std::string const& path) {
+  this->file.open(path, std::ios::binary | std::ios::trunc);
+  if(!this->file) {
+    throw std::runtime_error("Unable to create recording: " + path);
+  }
+
+  TrajectoryHeader header;
+  memcpy(header.magic, _MPIGRAV_TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version = _MPIGRAV_TRAJECTORY_VERSION;
+  header.bodySize = sizeof(Body);
+  this->file.write((char const*)&header, sizeof(header));
+  this->file.flush();
+}
+
+
+void TrajectoryWriter::Write(
+  std::vector<Body> const& bodies,
+  double const simulationTime) {
+
+  FrameHeader header;
+  header.bodyCount = bodies.size();
+  header.reserved = 0;
+  header.simulationTime = simulationTime;
+  this->file.write((char const*)&header, sizeof(header));
+  this->file.write(
+    (char const*)bodies.data(), bodies.size() * sizeof(Body));
+  this->file.flush();
+}
+
+
+//====[READER]===============================================================//
+
+TrajectoryReader::TrajectoryReader(std::string const& path) {
+  this->fd = open(path.c_str(), O_RDONLY);
+  if(this->fd < 0) {
+    throw std::runtime_error("Unable to open recording: " + path);
+  }
+
+  struct stat info;
+  fstat(this->fd, &info);
+  this->bytes = info.st_size;
+
+  TrajectoryHeader const* header = nullptr;
+  this->base = nullptr;
+  if(this->bytes >= sizeof(TrajectoryHeader)) {
+    void* p = mmap(
+      nullptr, this->bytes, PROT_READ, MAP_SHARED, this->fd, 0);
+    if(p != MAP_FAILED) {
+      this->base = (char const*)p;
+      header = (TrajectoryHeader const*)p;
+    }
+  }
+
+  if(!header ||
+     memcmp(header->magic, _MPIGRAV_TRAJECTORY_MAGIC, 8) ||
+     header->version != _MPIGRAV_TRAJECTORY_VERSION ||
+     header->bodySize != sizeof(Body)) {
+    if(this->base) munmap((void*)this->base, this->bytes);
+    close(this->fd);
+    throw std::runtime_error("Not a trajectory recording: " + path);
+  }
+
+  // Frames are played in order
+  madvise((void*)this->base, this->bytes, MADV_SEQUENTIAL);
+
+  // Frame sizes vary as bodies merge, so walk the headers
+  size_t offset = sizeof(TrajectoryHeader);
+  while(offset + sizeof(FrameHeader) <= this->bytes) {
+    FrameHeader const* frame = (FrameHeader const*)(this->base + offset);
+    size_t next =
+      offset + sizeof(FrameHeader) + ((size_t)frame->bodyCount * sizeof(Body));
+    if(next > this->bytes) break;
+    this->frameOffsets.push_back(offset);
+    offset = next;
+  }
+}
+
+
+TrajectoryReader::~TrajectoryReader(void) {
+  munmap((void*)this->base, this->bytes);
+  close(this->fd);
+}
@@ -0,0 +1,77 @@
+#include "compute/Density.hpp"
+
+
+// standard
+#include <cmath>
+#include <algorithm>
+
+
+// Internal
+#include "compute/MiscMPI.hpp"
+
+
+DensityProjection::DensityProjection(
+  unsigned const resolution, float const extent) {
+
+  this->resolution = resolution;
+  this->extent = extent;
+  this->grid.resize(resolution * resolution);
+}
+
+
+// Nearest grid point deposit, cells are shared between threads
+void DensityProjection::Deposit(
+  float const* m, Vec3 const* r, unsigned const start, unsigned const end) {
+
+  std::fill(this->grid.begin(), this->grid.end(), 0.0f);
+  float scale = this->resolution / (2 * this->extent);
+  int top = this->resolution;
+  float* cells = this->grid.data();
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = start; i < end; i++) {
+    int x = (int)std::floor((r[i].x + this->extent) * scale);
+    int y = (int)std::floor((r[i].y + this->extent) * scale);
+    if(x < 0 || y < 0 || x >= top || y >= top) continue;
+
+    #pragma omp atomic
+    cells[(y * top) + x] += m[i];
+  }
+}
+
+
+void DensityProjection::Reduce(int const root, MPI_Comm const comm) {
+  if(MyRank(comm) == root) {
+    MPI_Reduce(
+      MPI_IN_PLACE, this->grid.data(), this->grid.size(), MPI_FLOAT,
+      MPI_SUM, root, comm);
+  } else {
+    MPI_Reduce(
+      this->grid.data(), nullptr, this->grid.size(), MPI_FLOAT,
+      MPI_SUM, root, comm);
+  }
+}
+
+
+DensityImage DensityProjection::Image(void) const {
+  DensityImage image;
+  image.resolution = this->resolution;
+  image.extent = this->extent;
+  image.pixels.resize(this->grid.size());
+
+  float densest = 0;
+  for(unsigned i = 0; i < this->grid.size(); i++) {
+    densest = std::max(densest, this->grid[i]);
+  }
+  if(densest <= 0) return image;
+
+  float range = _MPIGRAV_DENSITY_DYNAMIC_RANGE;
+  float scale = 255.0f / std::log1p(range);
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < this->grid.size(); i++) {
+    float level = std::log1p(range * this->grid[i] / densest) * scale;
+    image.pixels[i] = (uint8_t)std::min(255.0f, level + 0.5f);
+  }
+  return image;
+}
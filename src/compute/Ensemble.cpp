@@ -0,0 +1,338 @@
+#include "compute/Ensemble.hpp"
+
+
+// standard
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+
+// External
+#include "mpi.h"
+#include "omp.h"
+
+
+// Internal
+#include "compute/MiscMPI.hpp"
+#include "compute/Integrators.hpp"
+
+
+// Packs this rank's share of the members into the integrator buffers
+Ensemble::Ensemble(
+  std::vector<EnsembleMember> const& members,
+  std::string const& cacheDir) {
+
+  this->DistributeWork(members);
+
+  unsigned first = this->rankUniverseOffsets[MyRank()];
+  unsigned count = this->rankUniverseCounts[MyRank()];
+
+  this->bodyOffsets.push_back(0);
+  for(unsigned u = first; u < first + count; u++) {
+    EnsembleMember const& member = members[u];
+    for(unsigned i = 0; i < member.bodies.size(); i++) {
+      this->m.push_back(member.bodies[i].m);
+      this->r.push_back(member.bodies[i].r);
+      this->bodyUniverse.push_back(u - first);
+    }
+    this->bodyOffsets.push_back(this->m.size());
+    this->G.push_back(member.G);
+    this->dt.push_back(member.dt);
+    this->e.push_back(member.e);
+  }
+
+  this->bodyCount = this->m.size();
+  this->v.assign(this->bodyCount, Vec3(0, 0, 0));
+  this->a.assign(this->bodyCount, Vec3(0, 0, 0));
+  this->rNext.assign(this->bodyCount, Vec3(0, 0, 0));
+  this->vNext.assign(this->bodyCount, Vec3(0, 0, 0));
+  this->aNext.assign(this->bodyCount, Vec3(0, 0, 0));
+
+  // Print out work assignments
+  if(MyRank() == 0) {
+    std::cout << "\n[ENSEMBLE DISTRIBUTION]\n";
+    for(int i = 0; i < RankCount(); i++) {
+      std::cout << "Process " << i << ") universes: ";
+      std::cout << this->rankUniverseOffsets[i] << " - ";
+      std::cout << this->rankUniverseOffsets[i] + this->rankUniverseCounts[i];
+      std::cout << "\n";
+    }
+  }
+
+  // Initialise opencl stuff
+  this->deviceCurrent = false;
+  if(this->bodyCount) {
+    try {
+      this->InitCL(cacheDir);
+    } catch (cl::Error err) {
+      std::cout << err.what() << "(" << err.err() << ")\n";
+      exit(1);
+    }
+  }
+}
+
+
+// Each universe costs its pair count, it goes to the rank whose share of
+// the total cost contains the universe's midpoint. Universe 0 is the one
+// shown to clients, so it always stays on rank 0. With more ranks than
+// universes some ranks get none & sit idle.
+void Ensemble::DistributeWork(std::vector<EnsembleMember> const& members) {
+  double total = 0;
+  for(unsigned u = 0; u < members.size(); u++) {
+    double n = members[u].bodies.size();
+    total += n * n;
+  }
+
+  this->rankUniverseCounts.assign(RankCount(), 0);
+  this->rankUniverseOffsets.assign(RankCount(), 0);
+
+  double prefix = 0;
+  for(unsigned u = 0; u < members.size(); u++) {
+    double n = members[u].bodies.size();
+    double mid = prefix + ((n * n) / 2);
+    int rank = total > 0 && u ? (int)((mid * RankCount()) / total) : 0;
+    this->rankUniverseCounts[std::min(rank, RankCount() - 1)]++;
+    prefix += n * n;
+  }
+
+  for(int i = 1; i < RankCount(); i++) {
+    this->rankUniverseOffsets[i] =
+      this->rankUniverseOffsets[i - 1] + this->rankUniverseCounts[i - 1];
+  }
+}
+
+
+unsigned Ensemble::LocalUniverseCount(void) {
+  return this->rankUniverseCounts[MyRank()];
+}
+
+
+//====[OPENCL]===============================================================//
+
+void Ensemble::InitCL(std::string const& cacheDir) {
+  this->clContext = cl::Context(CL_DEVICE_TYPE_CPU);
+  this->clDevice = this->clContext.getInfo<CL_CONTEXT_DEVICES>()[0];
+  this->clCommandQueue = cl::CommandQueue(this->clContext, this->clDevice);
+
+  // Integrator terms, swapped between steps
+  size_t floatBytes = this->bodyCount * sizeof(float);
+  size_t vecBytes = this->bodyCount * sizeof(Vec3);
+  this->clBuf_m = cl::Buffer(this->clContext, CL_MEM_READ_ONLY, floatBytes);
+  this->clBuf_r = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+  this->clBuf_v = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+  this->clBuf_a = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+  this->clBuf_rNext = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+  this->clBuf_vNext = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+  this->clBuf_aNext = cl::Buffer(this->clContext, CL_MEM_READ_WRITE, vecBytes);
+
+  // Per universe parameters & layout, work groups never span universes
+  unsigned groupSize = this->clKernelConfig.workGroupSize;
+  unsigned bodiesPerItem = this->clKernelConfig.bodiesPerItem;
+  std::vector<float> params;
+  std::vector<int> universes;
+  std::vector<int> groupUniverse;
+  for(unsigned u = 0; u < this->LocalUniverseCount(); u++) {
+    unsigned count = this->bodyOffsets[u + 1] - this->bodyOffsets[u];
+    unsigned items = (count + bodiesPerItem - 1) / bodiesPerItem;
+    unsigned groups = (items + groupSize - 1) / groupSize;
+
+    float const p[4] = {this->G[u], this->dt[u], this->e[u] * this->e[u], 0};
+    int const l[4] = {
+      (int)this->bodyOffsets[u], (int)count,
+      (int)groupUniverse.size(), (int)groups};
+    params.insert(params.end(), p, p + 4);
+    universes.insert(universes.end(), l, l + 4);
+    groupUniverse.insert(groupUniverse.end(), groups, u);
+  }
+  this->clGroupCount = groupUniverse.size();
+
+  this->clBuf_params = cl::Buffer(
+    this->clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    params.size() * sizeof(float), params.data());
+  this->clBuf_universes = cl::Buffer(
+    this->clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    universes.size() * sizeof(int), universes.data());
+  this->clBuf_groupUniverse = cl::Buffer(
+    this->clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    groupUniverse.size() * sizeof(int), groupUniverse.data());
+
+  // Same source as the single universe kernels, always leapfrog
+  ProgramCache programCache(cacheDir);
+  this->clProgram = programCache.Build(
+    this->clContext, this->clDevice,
+    LoadKernelSource(_MPIGRAV_LEAPGROG_KERNEL_PATH),
+    this->clKernelConfig.BuildOptions() + " " +
+    IntegratorBuildOptions(INTEGRATOR_LEAPFROG));
+  this->clKernel = cl::Kernel(this->clProgram, "ensemble");
+
+  this->clKernel.setArg(7, this->clBuf_params);
+  this->clKernel.setArg(8, this->clBuf_universes);
+  this->clKernel.setArg(9, this->clBuf_groupUniverse);
+  this->SetKernelBufferArgs();
+}
+
+
+void Ensemble::SetKernelBufferArgs(void) {
+  this->clKernel.setArg(0, this->clBuf_m);
+  this->clKernel.setArg(1, this->clBuf_r);
+  this->clKernel.setArg(2, this->clBuf_v);
+  this->clKernel.setArg(3, this->clBuf_a);
+  this->clKernel.setArg(4, this->clBuf_rNext);
+  this->clKernel.setArg(5, this->clBuf_vNext);
+  this->clKernel.setArg(6, this->clBuf_aNext);
+}
+
+
+void Ensemble::WriteDeviceBuffers(void) {
+  size_t vecBytes = this->bodyCount * sizeof(Vec3);
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_m, CL_TRUE, 0, this->bodyCount * sizeof(float),
+    this->m.data());
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_r, CL_TRUE, 0, vecBytes, this->r.data());
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_v, CL_TRUE, 0, vecBytes, this->v.data());
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_a, CL_TRUE, 0, vecBytes, this->a.data());
+}
+
+
+void Ensemble::ReadDeviceBuffers(void) {
+  size_t vecBytes = this->bodyCount * sizeof(Vec3);
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_r, CL_TRUE, 0, vecBytes, this->r.data());
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_v, CL_TRUE, 0, vecBytes, this->v.data());
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_a, CL_TRUE, 0, vecBytes, this->a.data());
+}
+
+
+// One launch advances every local universe. Terms are only uploaded when
+// the host copy is newer, the buffers then ping-pong on the device.
+double Ensemble::IterateCL(void) {
+  double tStart = MPI_Wtime();
+  if(!this->bodyCount) return 0;
+
+  if(!this->deviceCurrent) {
+    this->WriteDeviceBuffers();
+    this->deviceCurrent = true;
+  }
+
+  unsigned groupSize = this->clKernelConfig.workGroupSize;
+  this->clCommandQueue.enqueueNDRangeKernel(
+    this->clKernel, cl::NullRange,
+    cl::NDRange(this->clGroupCount * groupSize), cl::NDRange(groupSize));
+  this->clCommandQueue.finish();
+
+  std::swap(this->clBuf_r, this->clBuf_rNext);
+  std::swap(this->clBuf_v, this->clBuf_vNext);
+  std::swap(this->clBuf_a, this->clBuf_aNext);
+  this->SetKernelBufferArgs();
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+//====[CPU]==================================================================//
+
+// One openmp region over every local body. Rows are short and uneven in
+// length, so they are handed out dynamically.
+double Ensemble::Iterate(void) {
+  double tStart = MPI_Wtime();
+
+  if(this->deviceCurrent) {
+    this->ReadDeviceBuffers();
+    this->deviceCurrent = false;
+  }
+
+  // Integrator views for each universe, they differ only in dt
+  std::vector<StepState> states(this->LocalUniverseCount());
+  for(unsigned u = 0; u < states.size(); u++) {
+    StepState& s = states[u];
+    s.r = this->r.data();
+    s.v = this->v.data();
+    s.a = this->a.data();
+    s.j = nullptr;
+    s.rNext = this->rNext.data();
+    s.vNext = this->vNext.data();
+    s.aNext = this->aNext.data();
+    s.jNext = nullptr;
+    s.start = this->bodyOffsets[u];
+    s.end = this->bodyOffsets[u + 1];
+    s.dt = this->dt[u];
+  }
+
+  #pragma omp parallel for schedule(dynamic, 64)
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    unsigned u = this->bodyUniverse[i];
+    float e2 = this->e[u] * this->e[u];
+
+    Vec3 ai(0, 0, 0);
+    for(unsigned k = states[u].start; k < states[u].end; k++) {
+      if(this->r[i] != this->r[k]) {
+        Vec3 dr = this->r[k] - this->r[i];
+        float r2 = Dot(dr, dr);
+        ai = ai + (dr * (this->m[k] / (sqrt(r2) * (r2 + e2))));
+      }
+    }
+    this->aNext[i] = ai * this->G[u];
+    Leapfrog::Integrate(states[u], i);
+  }
+
+  std::swap(this->r, this->rNext);
+  std::swap(this->v, this->vNext);
+  std::swap(this->a, this->aNext);
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+double Ensemble::Iterate(engine_t const engine) {
+  switch(engine) {
+    case ENGINE_CPU: return this->Iterate();
+    case ENGINE_OPENCL: return this->IterateCL();
+    default:
+      throw std::invalid_argument("Ensembles need the cpu or opencl engine");
+  }
+}
+
+
+//====[ACCESS]===============================================================//
+
+unsigned Ensemble::GetUniverseCount(void) {
+  return this->rankUniverseOffsets.back() + this->rankUniverseCounts.back();
+}
+
+
+bool Ensemble::Owns(unsigned const universe) {
+  unsigned first = this->rankUniverseOffsets[MyRank()];
+  return universe >= first && universe < first + this->LocalUniverseCount();
+}
+
+
+// Current bodies of a universe owned by this rank
+std::vector<Body> Ensemble::GetBodyData(unsigned const universe) {
+  if(!this->Owns(universe)) {
+    throw std::out_of_range("Universe is owned by another rank");
+  }
+
+  unsigned u = universe - this->rankUniverseOffsets[MyRank()];
+  unsigned start = this->bodyOffsets[u];
+  unsigned count = this->bodyOffsets[u + 1] - start;
+
+  if(this->deviceCurrent) {
+    this->clCommandQueue.enqueueReadBuffer(
+      this->clBuf_r, CL_TRUE, start * sizeof(Vec3), count * sizeof(Vec3),
+      &this->r[start]);
+  }
+
+  std::vector<Body> bodyData(count);
+  for(unsigned i = 0; i < count; i++) {
+    bodyData[i].m = this->m[start + i];
+    bodyData[i].r = this->r[start + i];
+  }
+  return bodyData;
+}
@@ -0,0 +1,36 @@
+#include "compute/FFT.hpp"
+
+
+// standard
+#include <cmath>
+#include <utility>
+
+
+// Iterative cooley-tukey, bit reversal followed by butterflies
+void FFT(complex_t* data, unsigned const n, bool const inverse) {
+
+  // Bit reversal permutation
+  for(unsigned i = 1, j = 0; i < n; i++) {
+    unsigned bit = n >> 1;
+    for(; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if(i < j) std::swap(data[i], data[j]);
+  }
+
+  // Butterflies, twiddles are accumulated in double to limit drift
+  double sign = inverse ? 1.0 : -1.0;
+  for(unsigned len = 2; len <= n; len <<= 1) {
+    double angle = sign * 2.0 * M_PI / len;
+    std::complex<double> step(cos(angle), sin(angle));
+    for(unsigned i = 0; i < n; i += len) {
+      std::complex<double> w(1.0, 0.0);
+      for(unsigned k = 0; k < len / 2; k++) {
+        complex_t u = data[i + k];
+        complex_t t = data[i + k + (len / 2)] * complex_t(w);
+        data[i + k] = u + t;
+        data[i + k + (len / 2)] = u - t;
+        w *= step;
+      }
+    }
+  }
+}
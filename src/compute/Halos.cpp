@@ -0,0 +1,222 @@
+#include "compute/Halos.hpp"
+
+
+// standard
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+
+// Internal
+#include "compute/MiscMPI.hpp"
+#include "compute/SpatialHash.hpp"
+
+
+HaloFinder::HaloFinder(float const linkingLength, unsigned const minMembers) {
+  this->linkingLength = linkingLength;
+  this->minMembers = std::max(minMembers, 1u);
+}
+
+
+// Path halving
+unsigned HaloFinder::Root(unsigned i) {
+  while(this->parent[i] != i) {
+    i = this->parent[i] = this->parent[this->parent[i]];
+  }
+  return i;
+}
+
+
+void HaloFinder::Link(unsigned const i, unsigned const j) {
+  unsigned ri = this->Root(i);
+  unsigned rj = this->Root(j);
+  if(ri < rj) this->parent[rj] = ri;
+  else if(rj < ri) this->parent[ri] = rj;
+}
+
+
+// A fraction of the mean spacing of the sources in their bounding box
+float HaloFinder::LinkingLength(
+  float const* m, Vec3 const* r, unsigned const count) {
+
+  if(this->linkingLength > 0) return this->linkingLength;
+
+  float xMin = INFINITY, yMin = INFINITY, zMin = INFINITY;
+  float xMax = -INFINITY, yMax = -INFINITY, zMax = -INFINITY;
+  unsigned sources = 0;
+
+  #pragma omp parallel for schedule(static) reduction(+:sources) \
+    reduction(min:xMin, yMin, zMin) reduction(max:xMax, yMax, zMax)
+  for(unsigned i = 0; i < count; i++) {
+    if(m[i] == 0) continue;
+    xMin = std::min(xMin, r[i].x); xMax = std::max(xMax, r[i].x);
+    yMin = std::min(yMin, r[i].y); yMax = std::max(yMax, r[i].y);
+    zMin = std::min(zMin, r[i].z); zMax = std::max(zMax, r[i].z);
+    sources++;
+  }
+  if(sources < 2) return 0;
+
+  float volume = (xMax - xMin) * (yMax - yMin) * (zMax - zMin);
+  return _MPIGRAV_DEFAULT_LINKING_FRACTION * std::cbrt(volume / sources);
+}
+
+
+// Each rank links its sources to the later sources within reach, as for
+// collisions, so every pair is found by exactly one rank
+void HaloFinder::LinkDomain(
+  float const* m, Vec3 const* r, unsigned const count,
+  unsigned const start, unsigned const end, float const b) {
+
+  this->parent.resize(count);
+  for(unsigned i = 0; i < count; i++) this->parent[i] = i;
+  if(b <= 0) return;
+
+  float b2 = b * b;
+  SpatialHash hash(b);
+  hash.Build(r, count);
+
+  #pragma omp parallel
+  {
+    std::vector<unsigned> threadPairs;
+
+    #pragma omp for schedule(dynamic, 256) nowait
+    for(unsigned i = start; i < end; i++) {
+      Vec3 ri = r[i];
+      hash.ForEachNeighbour(ri, [&](unsigned const j) {
+        if(j <= i || m[j] == 0) return;
+        Vec3 dr = r[j] - ri;
+        if((dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z) <= b2) {
+          threadPairs.push_back(i);
+          threadPairs.push_back(j);
+        }
+      });
+    }
+
+    // The forest is shared, threads take turns linking what they found
+    #pragma omp critical
+    for(unsigned p = 0; p < threadPairs.size(); p += 2) {
+      this->Link(threadPairs[p], threadPairs[p + 1]);
+    }
+  }
+}
+
+
+// Every label is the smallest index of a body known to be in the same
+// group, ranks take the smallest label any of them has & link each body to
+// it until no rank learns anything new. Groups spanning k domains settle
+// in about k rounds.
+void HaloFinder::MergeRanks(MPI_Comm const comm) {
+  unsigned count = this->parent.size();
+  this->labels.resize(count);
+  for(unsigned i = 0; i < count; i++) this->labels[i] = this->Root(i);
+  if(RankCount(comm) == 1) return;
+
+  while(true) {
+    MPI_Allreduce(
+      MPI_IN_PLACE, this->labels.data(), count, MPI_UNSIGNED, MPI_MIN, comm);
+
+    for(unsigned i = 0; i < count; i++) this->Link(i, this->labels[i]);
+
+    int changed = 0;
+    for(unsigned i = 0; i < count; i++) {
+      unsigned root = this->Root(i);
+      changed |= root != this->labels[i];
+      this->labels[i] = root;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR, comm);
+    if(!changed) break;
+  }
+}
+
+
+// Labels are the same on every rank by now, so every rank picks the same
+// groups & only the sums over each domain need reducing
+void HaloFinder::Catalogue(
+  float const* m, Vec3 const* r, Vec3 const* v, unsigned const count,
+  unsigned const start, unsigned const end, MPI_Comm const comm) {
+
+  std::vector<unsigned> memberCounts(count, 0);
+  for(unsigned i = 0; i < count; i++) {
+    if(m[i] != 0) memberCounts[this->labels[i]]++;
+  }
+
+  std::vector<int> groups(count, -1);
+  unsigned groupCount = 0;
+  for(unsigned i = 0; i < count; i++) {
+    if(memberCounts[i] >= this->minMembers) groups[i] = groupCount++;
+  }
+
+  // Mass, then mass weighted position & velocity
+  std::vector<double> sums(groupCount * 7, 0);
+  for(unsigned i = start; i < end; i++) {
+    int g = groups[this->labels[i]];
+    if(g < 0 || m[i] == 0) continue;
+    double* s = &sums[g * 7];
+    s[0] += m[i];
+    s[1] += m[i] * r[i].x; s[2] += m[i] * r[i].y; s[3] += m[i] * r[i].z;
+    s[4] += m[i] * v[i].x; s[5] += m[i] * v[i].y; s[6] += m[i] * v[i].z;
+  }
+  if(groupCount) {
+    MPI_Allreduce(
+      MPI_IN_PLACE, sums.data(), sums.size(), MPI_DOUBLE, MPI_SUM, comm);
+  }
+
+  this->halos.resize(groupCount);
+  for(unsigned i = 0; i < count; i++) {
+    if(groups[i] < 0) continue;
+    double const* s = &sums[groups[i] * 7];
+    Halo& halo = this->halos[groups[i]];
+    halo.m = s[0];
+    halo.r = Vec3(s[1] / s[0], s[2] / s[0], s[3] / s[0]);
+    halo.v = Vec3(s[4] / s[0], s[5] / s[0], s[6] / s[0]);
+    halo.memberCount = memberCounts[i];
+  }
+
+  std::stable_sort(
+    this->halos.begin(), this->halos.end(),
+    [](Halo const& a, Halo const& b) {
+      return a.memberCount > b.memberCount;
+    });
+}
+
+
+void HaloFinder::Find(
+  float const* m, Vec3 const* r, Vec3 const* v, unsigned const count,
+  unsigned const start, unsigned const end, MPI_Comm const comm) {
+
+  this->LinkDomain(m, r, count, start, end, this->LinkingLength(m, r, count));
+  this->MergeRanks(comm);
+  this->Catalogue(m, r, v, count, start, end, comm);
+}
+
+
+//====[CATALOGUE OUTPUT]=====================================================//
+
+HaloCatalogueWriter::HaloCatalogueWriter(std::string const& path) {
+  this->file.open(path, std::ios::trunc);
+  if(!this->file) {
+    throw std::runtime_error("Unable to create halo catalogue: " + path);
+  }
+  this->file << "# step <n> time <t> halos <k>, then k lines of\n";
+  this->file << "# m x y z vx vy vz members\n";
+  this->file.flush();
+}
+
+
+void HaloCatalogueWriter::Write(
+  std::vector<Halo> const& halos,
+  unsigned const step,
+  double const simulationTime) {
+
+  this->file << "step " << step << " time " << simulationTime;
+  this->file << " halos " << halos.size() << "\n";
+  for(unsigned k = 0; k < halos.size(); k++) {
+    Halo const& h = halos[k];
+    this->file << h.m << " ";
+    this->file << h.r.x << " " << h.r.y << " " << h.r.z << " ";
+    this->file << h.v.x << " " << h.v.y << " " << h.v.z << " ";
+    this->file << h.memberCount << "\n";
+  }
+  this->file.flush();
+}
@@ -0,0 +1,21 @@
+#include "compute/Integrators.hpp"
+
+
+// standard
+#include <sstream>
+
+
+// Parse integrator from a command line string
+integrator_t ParseIntegrator(std::string const& str) {
+  if(str == "hermite") return INTEGRATOR_HERMITE;
+  if(str == "yoshida") return INTEGRATOR_YOSHIDA;
+  return INTEGRATOR_LEAPFROG;
+}
+
+
+// Values match the INTEGRATOR_* macros in the kernel source
+std::string IntegratorBuildOptions(integrator_t const integrator) {
+  std::stringstream ss;
+  ss << "-DINTEGRATOR=" << (int)integrator;
+  return ss.str();
+}
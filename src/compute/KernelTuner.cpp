@@ -0,0 +1,179 @@
+#include "compute/KernelTuner.hpp"
+
+
+// standard
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <cstdio>
+
+
+// Parse tuning mode from a command line string
+tuning_mode_t ParseTuningMode(std::string const& str) {
+  if(str == "off") return TUNING_OFF;
+  if(str == "force") return TUNING_FORCE;
+  return TUNING_AUTO;
+}
+
+
+//====[KERNEL CONFIG]========================================================//
+
+std::string KernelConfig::BuildOptions(void) const {
+  std::stringstream ss;
+  ss << "-DWORK_GROUP_SIZE=" << this->workGroupSize;
+  ss << " -DBODIES_PER_ITEM=" << this->bodiesPerItem;
+  ss << " -DUNROLL_FACTOR=" << this->unrollFactor;
+  ss << " -DTILE_SIZE=" << this->tileSize;
+  return ss.str();
+}
+
+
+std::string KernelConfig::Str(void) const {
+  std::stringstream ss;
+  ss << "work group: " << this->workGroupSize;
+  ss << ", bodies per item: " << this->bodiesPerItem;
+  ss << ", unroll: " << this->unrollFactor;
+  ss << ", tile: " << this->tileSize;
+  return ss.str();
+}
+
+
+// Tiles of float3 positions & float masses, float3 velocities or a
+// single placeholder, then the fused kernel's per group |a|^2 reduction
+unsigned long KernelConfig::LocalBytes(bool const jerk) const {
+  unsigned long float3Bytes = 4 * sizeof(float);
+  unsigned long tileBytes = this->tileSize * (float3Bytes + sizeof(float));
+  unsigned long jerkBytes = (jerk ? this->tileSize : 1) * float3Bytes;
+  return tileBytes + jerkBytes + (this->workGroupSize * sizeof(float));
+}
+
+
+bool KernelConfig::Fits(
+  unsigned const maxWorkGroupSize,
+  unsigned long const localMem,
+  bool const jerk) const {
+
+  return
+    this->workGroupSize <= maxWorkGroupSize &&
+    this->LocalBytes(jerk) <= localMem &&
+    this->unrollFactor <= this->tileSize;
+}
+
+
+//====[TUNING CACHE]=========================================================//
+
+TuningCache::TuningCache(std::string const& path) : path(path) {}
+
+
+static unsigned Bucket(unsigned const count) {
+  unsigned bucket = 0;
+  while((2u << bucket) <= count) bucket++;
+  return bucket;
+}
+
+
+std::string TuningCache::Key(
+  std::string const& device, std::string const& driver,
+  std::string const& variant,
+  unsigned const domainSize, unsigned const sourceCount) {
+
+  std::stringstream ss;
+  ss << device << "\t" << driver << "\t" << variant;
+  ss << "\tn2^" << Bucket(domainSize) << "\ts2^" << Bucket(sourceCount);
+  return ss.str();
+}
+
+
+// Lines are the tab separated key then "\t<config>"
+bool TuningCache::Lookup(std::string const& key, KernelConfig& config) {
+  std::ifstream fp(this->path);
+  std::string line;
+  while(std::getline(fp, line)) {
+    size_t split = line.rfind('\t');
+    if(split == std::string::npos || line.substr(0, split) != key) continue;
+
+    std::stringstream ss(line.substr(split + 1));
+    KernelConfig cached;
+    ss >> cached.workGroupSize >> cached.bodiesPerItem;
+    ss >> cached.unrollFactor >> cached.tileSize;
+    if(!ss.fail()) {
+      config = cached;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Rewrites the whole cache, replacing any existing entry for the key
+void TuningCache::Store(std::string const& key, KernelConfig const& config) {
+  std::vector<std::string> lines;
+  std::ifstream in(this->path);
+  std::string line;
+  while(std::getline(in, line)) {
+    size_t split = line.rfind('\t');
+    if(split != std::string::npos && line.substr(0, split) == key) continue;
+    lines.push_back(line);
+  }
+  in.close();
+
+  std::stringstream ss;
+  ss << key << "\t" << config.workGroupSize << " " << config.bodiesPerItem;
+  ss << " " << config.unrollFactor << " " << config.tileSize;
+  lines.push_back(ss.str());
+
+  // Write to a temporary and rename so readers never see a partial file
+  std::string tmpPath = this->path + ".tmp";
+  std::ofstream out(tmpPath);
+  for(unsigned i = 0; i < lines.size(); i++) out << lines[i] << "\n";
+  out.close();
+  if(!out || rename(tmpPath.c_str(), this->path.c_str())) {
+    std::cout << "Unable to write tuning cache: " << this->path << "\n";
+  }
+}
+
+
+//====[KERNEL TUNER]=========================================================//
+
+KernelTuner::KernelTuner(void) :
+  workGroupSizes({16, 32, 64, 128, 256}),
+  bodiesPerItems({1, 2, 4}),
+  unrollFactors({1, 2, 4, 8}),
+  tileSizes({32, 64, 128, 256, 512}) {}
+
+
+// Tunes one parameter at a time, holding the others at their best so far
+KernelConfig KernelTuner::Tune(
+  KernelConfig const& start,
+  std::function<bool(KernelConfig const&)> const& valid,
+  std::function<double(KernelConfig const&)> const& benchmark) {
+
+  KernelConfig best = start;
+  double tBest = std::numeric_limits<double>::infinity();
+  if(valid(best)) tBest = benchmark(best);
+
+  std::vector<unsigned> const* candidates[] = {
+    &this->workGroupSizes, &this->bodiesPerItems,
+    &this->unrollFactors, &this->tileSizes};
+  unsigned KernelConfig::* fields[] = {
+    &KernelConfig::workGroupSize, &KernelConfig::bodiesPerItem,
+    &KernelConfig::unrollFactor, &KernelConfig::tileSize};
+
+  for(unsigned p = 0; p < 4; p++) {
+    for(unsigned c = 0; c < candidates[p]->size(); c++) {
+      KernelConfig config = best;
+      config.*fields[p] = (*candidates[p])[c];
+      if(config.*fields[p] == best.*fields[p] || !valid(config)) continue;
+
+      double t = benchmark(config);
+      std::cout << "  " << config.Str() << ") time: " << t << "s\n";
+      if(t < tBest) {
+        tBest = t;
+        best = config;
+      }
+    }
+  }
+
+  return best;
+}
@@ -0,0 +1,113 @@
+#include "compute/Morton.hpp"
+
+
+// standard
+#include <algorithm>
+#include <limits>
+
+
+// External
+#include "omp.h"
+
+
+// Spread the low 10 bits of x out to every third bit
+static uint32_t SpreadBits(uint32_t x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+
+std::vector<uint32_t> MortonKeys(Vec3 const* r, unsigned const count) {
+  float inf = std::numeric_limits<float>::infinity();
+  float xMin = inf, yMin = inf, zMin = inf;
+  float xMax = -inf, yMax = -inf, zMax = -inf;
+
+  #pragma omp parallel for schedule(static) \
+    reduction(min:xMin, yMin, zMin) reduction(max:xMax, yMax, zMax)
+  for(unsigned i = 0; i < count; i++) {
+    xMin = std::min(xMin, r[i].x); xMax = std::max(xMax, r[i].x);
+    yMin = std::min(yMin, r[i].y); yMax = std::max(yMax, r[i].y);
+    zMin = std::min(zMin, r[i].z); zMax = std::max(zMax, r[i].z);
+  }
+
+  // Cells of the bounding cube along each axis
+  float cells = (float)(1u << _MPIGRAV_MORTON_AXIS_BITS);
+  float extent = std::max(xMax - xMin, std::max(yMax - yMin, zMax - zMin));
+  float scale = extent > 0 ? cells / extent : 0;
+  unsigned top = (1u << _MPIGRAV_MORTON_AXIS_BITS) - 1;
+
+  std::vector<uint32_t> keys(count);
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < count; i++) {
+    unsigned x = std::min(top, (unsigned)((r[i].x - xMin) * scale));
+    unsigned y = std::min(top, (unsigned)((r[i].y - yMin) * scale));
+    unsigned z = std::min(top, (unsigned)((r[i].z - zMin) * scale));
+    keys[i] = SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+  }
+
+  return keys;
+}
+
+
+// Each pass counts digits per thread, offsets them digit major & thread
+// minor, then scatters. Threads get the same static chunks in both loops
+// so every pass is stable.
+std::vector<unsigned> SortOrder(
+  std::vector<uint32_t> const& keys, unsigned const keyBits) {
+
+  unsigned const count = keys.size();
+  unsigned const radix = 1u << _MPIGRAV_RADIX_BITS;
+  unsigned const mask = radix - 1;
+
+  std::vector<uint32_t> k(keys);
+  std::vector<uint32_t> kSorted(count);
+  std::vector<unsigned> order(count);
+  std::vector<unsigned> orderSorted(count);
+  for(unsigned i = 0; i < count; i++) order[i] = i;
+
+  int threadCount = omp_get_max_threads();
+  std::vector<unsigned> offsets(threadCount * radix);
+
+  for(unsigned shift = 0; shift < keyBits; shift += _MPIGRAV_RADIX_BITS) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+
+    #pragma omp parallel
+    {
+      unsigned* threadOffsets = &offsets[omp_get_thread_num() * radix];
+
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < count; i++) {
+        threadOffsets[(k[i] >> shift) & mask]++;
+      }
+
+      #pragma omp single
+      {
+        unsigned total = 0;
+        for(unsigned d = 0; d < radix; d++) {
+          for(int t = 0; t < threadCount; t++) {
+            unsigned n = offsets[(t * radix) + d];
+            offsets[(t * radix) + d] = total;
+            total += n;
+          }
+        }
+      }
+
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < count; i++) {
+        unsigned dst = threadOffsets[(k[i] >> shift) & mask]++;
+        kSorted[dst] = k[i];
+        orderSorted[dst] = order[i];
+      }
+    }
+
+    k.swap(kSorted);
+    order.swap(orderSorted);
+  }
+
+  return order;
+}
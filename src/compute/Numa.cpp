@@ -0,0 +1,124 @@
+#include "compute/Numa.hpp"
+
+
+// standard
+#include <iostream>
+#include <new>
+#include <vector>
+
+
+// External
+#include <sys/mman.h>
+#include <sched.h>
+#include "omp.h"
+
+
+// Huge page size assumed for alignment
+#define _MPIGRAV_HUGE_PAGE_SIZE (2u << 20)
+
+
+// Parse huge page mode from a command line string
+hugepage_mode_t ParseHugePageMode(std::string const& str) {
+  if(str == "off") return HUGEPAGES_OFF;
+  if(str == "explicit") return HUGEPAGES_EXPLICIT;
+  return HUGEPAGES_TRANSPARENT;
+}
+
+
+//====[ARENA]================================================================//
+
+Arena::Arena(size_t const bytes, hugepage_mode_t const mode) :
+  base(nullptr), bytes(0) {
+
+  if(!bytes) return;
+  size_t size =
+    ((bytes + _MPIGRAV_HUGE_PAGE_SIZE - 1) / _MPIGRAV_HUGE_PAGE_SIZE) *
+    _MPIGRAV_HUGE_PAGE_SIZE;
+
+  // Reserved huge pages are always aligned
+  if(mode == HUGEPAGES_EXPLICIT) {
+    void* p = mmap(
+      nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED) {
+      this->base = p;
+      this->bytes = size;
+      return;
+    }
+    std::cout << "Explicit huge pages unavailable, using transparent\n";
+  }
+
+  // Over-map and trim so the region starts on a huge page boundary
+  size_t mapped = size + _MPIGRAV_HUGE_PAGE_SIZE;
+  void* p = mmap(
+    nullptr, mapped, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) throw std::bad_alloc();
+
+  char* start = (char*)p;
+  char* aligned = (char*)(
+    (((size_t)start + _MPIGRAV_HUGE_PAGE_SIZE - 1) / _MPIGRAV_HUGE_PAGE_SIZE) *
+    _MPIGRAV_HUGE_PAGE_SIZE);
+  if(aligned != start) munmap(start, aligned - start);
+  if(aligned + size != start + mapped) {
+    munmap(aligned + size, (start + mapped) - (aligned + size));
+  }
+
+  if(mode != HUGEPAGES_OFF) madvise(aligned, size, MADV_HUGEPAGE);
+
+  this->base = aligned;
+  this->bytes = size;
+}
+
+
+Arena::Arena(Arena&& other) : base(other.base), bytes(other.bytes) {
+  other.base = nullptr;
+  other.bytes = 0;
+}
+
+
+Arena& Arena::operator=(Arena&& other) {
+  if(this != &other) {
+    if(this->base) munmap(this->base, this->bytes);
+    this->base = other.base;
+    this->bytes = other.bytes;
+    other.base = nullptr;
+    other.bytes = 0;
+  }
+  return *this;
+}
+
+
+Arena::~Arena(void) {
+  if(this->base) munmap(this->base, this->bytes);
+}
+
+
+//====[THREAD PINNING]=======================================================//
+
+// Thread n is pinned to the n-th cpu this process may run on, so placement
+// chosen by the mpi launcher for each rank is respected. Thread 0 is the
+// main thread, it keeps the process's mask so threads it starts later,
+// like the server's & the metrics listener, aren't confined to one cpu.
+void PinThreads(void) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed)) return;
+
+  std::vector<int> cpus;
+  for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if(CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  if(cpus.empty()) return;
+
+  #pragma omp parallel
+  {
+    int thread = omp_get_thread_num();
+    if(thread != 0) {
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpus[thread % cpus.size()], &mask);
+      sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+    }
+  }
+}
@@ -0,0 +1,386 @@
+#include "compute/ParticleMesh.hpp"
+
+
+// standard
+#include <cmath>
+#include <stdexcept>
+
+
+// External
+#include "omp.h"
+
+
+// Internal
+#include "compute/MiscMPI.hpp"
+
+
+bool ValidMeshSize(int const gridSize, int const rankCount) {
+  return
+    gridSize > 0 && !(gridSize & (gridSize - 1)) && !(gridSize % rankCount);
+}
+
+
+ParticleMesh::ParticleMesh(
+  unsigned const gridSize, float const boxSize, MPI_Comm const comm) :
+  comm(comm), gridSize(gridSize), boxSize(boxSize) {
+
+  if(!ValidMeshSize(gridSize, RankCount(comm))) {
+    throw std::invalid_argument(
+      "Mesh size must be a power of two & a multiple of the rank count");
+  }
+
+  unsigned cells = gridSize * gridSize * gridSize;
+  unsigned planeCells = gridSize * gridSize;
+  this->cellSize = boxSize / gridSize;
+  this->slabSize = gridSize / RankCount(comm);
+  this->slabStart = this->slabSize * MyRank(comm);
+
+  this->density.resize((this->slabSize + 1) * planeCells);
+  this->potential.resize((this->slabSize + 3) * planeCells);
+  this->slab.resize(cells / RankCount(comm));
+  this->transposed.resize(cells / RankCount(comm));
+  this->sendBuf.resize(cells / RankCount(comm));
+  this->recvBuf.resize(cells / RankCount(comm));
+}
+
+
+unsigned ParticleMesh::Index(unsigned plane, int y, int z) const {
+  int n = this->gridSize;
+  y = ((y % n) + n) % n;
+  z = ((z % n) + n) % n;
+  return (((plane * n) + y) * n) + z;
+}
+
+
+// Lower cell of the 2x2x2 block a body overlaps, and its offset within it
+void ParticleMesh::CloudInCell(Vec3 const& p, int* cell, float* frac) const {
+  float half = this->boxSize / 2;
+  float u[3] = {
+    ((p.x + half) / this->cellSize) - 0.5f,
+    ((p.y + half) / this->cellSize) - 0.5f,
+    ((p.z + half) / this->cellSize) - 0.5f};
+  for(int d = 0; d < 3; d++) {
+    cell[d] = (int)std::floor(u[d]);
+    frac[d] = u[d] - cell[d];
+  }
+  int n = this->gridSize;
+  cell[0] = ((cell[0] % n) + n) % n;
+}
+
+
+// Deposit the density of bodies routed to this rank, each one's lower x
+// plane is in the slab, so the upper one is at most the plane after it
+void ParticleMesh::Deposit(std::vector<MeshBody> const& bodies) {
+  float cellVolume = this->cellSize * this->cellSize * this->cellSize;
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned k = 0; k < this->density.size(); k++) this->density[k] = 0;
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < bodies.size(); i++) {
+    int c[3];
+    float f[3];
+    this->CloudInCell(bodies[i].r, c, f);
+    float rho = bodies[i].m / cellVolume;
+    unsigned plane = c[0] - this->slabStart;
+
+    for(int dx = 0; dx < 2; dx++) {
+      for(int dy = 0; dy < 2; dy++) {
+        for(int dz = 0; dz < 2; dz++) {
+          float w =
+            (dx ? f[0] : 1 - f[0]) *
+            (dy ? f[1] : 1 - f[1]) *
+            (dz ? f[2] : 1 - f[2]);
+          unsigned idx = this->Index(plane + dx, c[1] + dy, c[2] + dz);
+          #pragma omp atomic
+          this->density[idx] += w * rho;
+        }
+      }
+    }
+  }
+
+  // The plane after the slab belongs at the start of the next one
+  unsigned planeCells = this->gridSize * this->gridSize;
+  std::vector<float> folded(planeCells);
+  this->ExchangePlane(this->density, this->slabSize, 1, folded.data());
+  for(unsigned k = 0; k < planeCells; k++) this->density[k] += folded[k];
+}
+
+
+// Send a plane of grid to the rank shift ranks on, receiving the same
+// plane of the rank shift ranks back
+void ParticleMesh::ExchangePlane(
+  std::vector<float>& grid, unsigned const plane, int const shift,
+  float* recv) {
+
+  int ranks = RankCount(this->comm);
+  int to = (((MyRank(this->comm) + shift) % ranks) + ranks) % ranks;
+  int from = (((MyRank(this->comm) - shift) % ranks) + ranks) % ranks;
+  int planeCells = this->gridSize * this->gridSize;
+
+  MPI_Sendrecv(
+    &grid[plane * planeCells], planeCells, MPI_FLOAT, to, 0,
+    recv, planeCells, MPI_FLOAT, from, 0, this->comm, MPI_STATUS_IGNORE);
+}
+
+
+// FFT count lines of gridSize values, element spacing stride, line spacing
+// lineStride. Lines are gathered so the transform runs on contiguous data.
+void ParticleMesh::FFTLines(
+  complex_t* data, unsigned const count, unsigned const stride,
+  unsigned const lineStride, bool const inverse) {
+
+  unsigned n = this->gridSize;
+
+  #pragma omp parallel
+  {
+    std::vector<complex_t> line(n);
+
+    #pragma omp for schedule(static)
+    for(unsigned l = 0; l < count; l++) {
+      complex_t* base = data + (l * lineStride);
+      for(unsigned k = 0; k < n; k++) line[k] = base[k * stride];
+      FFT(line.data(), n, inverse);
+      for(unsigned k = 0; k < n; k++) base[k * stride] = line[k];
+    }
+  }
+}
+
+
+// Redistribute between x slabs [x][y][z] and y slabs [y][x][z]
+void ParticleMesh::Transpose(bool const forward) {
+  unsigned n = this->gridSize;
+  unsigned s = this->slabSize;
+  unsigned ranks = RankCount(this->comm);
+  unsigned block = s * s * n;
+
+  std::vector<complex_t>& from = forward ? this->slab : this->transposed;
+  std::vector<complex_t>& to = forward ? this->transposed : this->slab;
+
+  // Pack, block k holds the rows rank k will own: [k][a][b][z]
+  #pragma omp parallel for schedule(static)
+  for(unsigned k = 0; k < ranks; k++) {
+    for(unsigned a = 0; a < s; a++) {
+      for(unsigned b = 0; b < s; b++) {
+        complex_t const* src = &from[((a * n) + (k * s) + b) * n];
+        complex_t* dst = &this->sendBuf[(k * block) + (((a * s) + b) * n)];
+        for(unsigned z = 0; z < n; z++) dst[z] = src[z];
+      }
+    }
+  }
+
+  MPI_Alltoall(
+    this->sendBuf.data(), block * sizeof(complex_t), MPI_BYTE,
+    this->recvBuf.data(), block * sizeof(complex_t), MPI_BYTE, this->comm);
+
+  // Unpack, block j came from rank j: [j][b][a][z] -> [a][j * s + b][z]
+  #pragma omp parallel for schedule(static)
+  for(unsigned j = 0; j < ranks; j++) {
+    for(unsigned b = 0; b < s; b++) {
+      for(unsigned a = 0; a < s; a++) {
+        complex_t const* src =
+          &this->recvBuf[(j * block) + (((b * s) + a) * n)];
+        complex_t* dst = &to[((a * n) + (j * s) + b) * n];
+        for(unsigned z = 0; z < n; z++) dst[z] = src[z];
+      }
+    }
+  }
+}
+
+
+// Solve poisson's equation for the density slab, leaving the potential of
+// the slab & its ghost planes
+void ParticleMesh::SolvePotential(void) {
+  unsigned n = this->gridSize;
+  unsigned s = this->slabSize;
+
+  for(unsigned k = 0; k < this->slab.size(); k++) {
+    this->slab[k] = complex_t(this->density[k], 0);
+  }
+
+  // Forward transform along z & y within each x plane, then along x
+  this->FFTLines(this->slab.data(), s * n, 1, n, false);
+  for(unsigned x = 0; x < s; x++) {
+    this->FFTLines(&this->slab[x * n * n], n, n, 1, false);
+  }
+  this->Transpose(true);
+  for(unsigned y = 0; y < s; y++) {
+    this->FFTLines(&this->transposed[y * n * n], n, n, 1, false);
+  }
+
+  // Multiply by the green's function, phi_k = -4 pi rho_k / k^2
+  float kUnit = 2 * M_PI / this->boxSize;
+  float norm = 1.0f / ((float)n * n * n);
+  #pragma omp parallel for schedule(static)
+  for(unsigned y = 0; y < s; y++) {
+    for(unsigned x = 0; x < n; x++) {
+      for(unsigned z = 0; z < n; z++) {
+        int nx = x < n / 2 ? (int)x : (int)x - (int)n;
+        int ny = (y + this->slabStart) < n / 2 ?
+          (int)(y + this->slabStart) : (int)(y + this->slabStart) - (int)n;
+        int nz = z < n / 2 ? (int)z : (int)z - (int)n;
+        float k2 = kUnit * kUnit * ((nx * nx) + (ny * ny) + (nz * nz));
+        complex_t& c = this->transposed[(((y * n) + x) * n) + z];
+        c = k2 > 0 ? c * (float)(-4 * M_PI * norm / k2) : complex_t(0, 0);
+      }
+    }
+  }
+
+  // Inverse transform in reverse order
+  for(unsigned y = 0; y < s; y++) {
+    this->FFTLines(&this->transposed[y * n * n], n, n, 1, true);
+  }
+  this->Transpose(false);
+  for(unsigned x = 0; x < s; x++) {
+    this->FFTLines(&this->slab[x * n * n], n, n, 1, true);
+  }
+  this->FFTLines(this->slab.data(), s * n, 1, n, true);
+
+  // The slab goes after the first ghost plane
+  unsigned planeCells = n * n;
+  for(unsigned k = 0; k < this->slab.size(); k++) {
+    this->potential[planeCells + k] = this->slab[k].real();
+  }
+  this->ShareGhostPlanes();
+}
+
+
+// The gradient at a body's planes reaches one plane before the slab & two
+// after, which with one plane per rank are two ranks on
+void ParticleMesh::ShareGhostPlanes(void) {
+  unsigned s = this->slabSize;
+  unsigned planeCells = this->gridSize * this->gridSize;
+  std::vector<float>& phi = this->potential;
+
+  this->ExchangePlane(phi, s, 1, &phi[0]);
+  this->ExchangePlane(phi, 1, -1, &phi[(s + 1) * planeCells]);
+  if(s > 1) this->ExchangePlane(phi, 2, -1, &phi[(s + 2) * planeCells]);
+  else this->ExchangePlane(phi, 1, -2, &phi[(s + 2) * planeCells]);
+}
+
+
+// Interpolate -grad(phi) with the same weights used for deposition
+Vec3 ParticleMesh::Interpolate(Vec3 const& p) const {
+  int c[3];
+  float f[3];
+  this->CloudInCell(p, c, f);
+  float inv2h = 1.0f / (2 * this->cellSize);
+  std::vector<float> const& phi = this->potential;
+
+  // Ghost planes shift the slab along by one
+  unsigned plane = c[0] - this->slabStart + 1;
+
+  Vec3 a(0, 0, 0);
+  for(int dx = 0; dx < 2; dx++) {
+    for(int dy = 0; dy < 2; dy++) {
+      for(int dz = 0; dz < 2; dz++) {
+        unsigned x = plane + dx;
+        int y = c[1] + dy;
+        int z = c[2] + dz;
+        float w =
+          (dx ? f[0] : 1 - f[0]) *
+          (dy ? f[1] : 1 - f[1]) *
+          (dz ? f[2] : 1 - f[2]);
+        Vec3 grad(
+          phi[this->Index(x + 1, y, z)] - phi[this->Index(x - 1, y, z)],
+          phi[this->Index(x, y + 1, z)] - phi[this->Index(x, y - 1, z)],
+          phi[this->Index(x, y, z + 1)] - phi[this->Index(x, y, z - 1)]);
+        a = a - (grad * (w * inv2h));
+      }
+    }
+  }
+  return a;
+}
+
+
+void ParticleMesh::ComputeAccelerations(
+  float const* m, Vec3 const* r,
+  unsigned const start, unsigned const end, Vec3* aOut) {
+
+  int ranks = RankCount(this->comm);
+  unsigned count = end - start;
+
+  // Route bodies to the slabs they're deposited on, grouped by rank
+  std::vector<int> owners(count);
+  std::vector<int> sendCounts(ranks, 0);
+  for(unsigned i = 0; i < count; i++) {
+    int c[3];
+    float f[3];
+    this->CloudInCell(r[start + i], c, f);
+    owners[i] = c[0] / this->slabSize;
+    sendCounts[owners[i]]++;
+  }
+
+  std::vector<int> recvCounts(ranks);
+  MPI_Alltoall(
+    sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, this->comm);
+
+  std::vector<int> sendOffsets(ranks, 0);
+  std::vector<int> recvOffsets(ranks, 0);
+  for(int k = 1; k < ranks; k++) {
+    sendOffsets[k] = sendOffsets[k - 1] + sendCounts[k - 1];
+    recvOffsets[k] = recvOffsets[k - 1] + recvCounts[k - 1];
+  }
+  unsigned received = recvOffsets[ranks - 1] + recvCounts[ranks - 1];
+
+  std::vector<MeshBody> sendBodies(count);
+  std::vector<int> cursor(sendOffsets);
+  for(unsigned i = 0; i < count; i++) {
+    MeshBody& body = sendBodies[cursor[owners[i]]++];
+    body.r = r[start + i];
+    body.m = m[start + i];
+  }
+
+  // Counts & offsets in bytes from here on
+  std::vector<int> sendBytes(ranks), sendByteOffsets(ranks);
+  std::vector<int> recvBytes(ranks), recvByteOffsets(ranks);
+  for(int k = 0; k < ranks; k++) {
+    sendBytes[k] = sendCounts[k] * sizeof(MeshBody);
+    sendByteOffsets[k] = sendOffsets[k] * sizeof(MeshBody);
+    recvBytes[k] = recvCounts[k] * sizeof(MeshBody);
+    recvByteOffsets[k] = recvOffsets[k] * sizeof(MeshBody);
+  }
+
+  std::vector<MeshBody> bodies(received);
+  MPI_Alltoallv(
+    sendBodies.data(), sendBytes.data(), sendByteOffsets.data(), MPI_BYTE,
+    bodies.data(), recvBytes.data(), recvByteOffsets.data(), MPI_BYTE,
+    this->comm);
+
+  this->Deposit(bodies);
+  this->SolvePotential();
+
+  std::vector<Vec3> accelerations(received);
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < received; i++) {
+    accelerations[i] = this->Interpolate(bodies[i].r);
+  }
+
+  // Send the accelerations back the way the bodies came
+  for(int k = 0; k < ranks; k++) {
+    sendBytes[k] = sendCounts[k] * sizeof(Vec3);
+    sendByteOffsets[k] = sendOffsets[k] * sizeof(Vec3);
+    recvBytes[k] = recvCounts[k] * sizeof(Vec3);
+    recvByteOffsets[k] = recvOffsets[k] * sizeof(Vec3);
+  }
+
+  std::vector<Vec3> returned(count);
+  MPI_Alltoallv(
+    accelerations.data(), recvBytes.data(), recvByteOffsets.data(), MPI_BYTE,
+    returned.data(), sendBytes.data(), sendByteOffsets.data(), MPI_BYTE,
+    this->comm);
+
+  cursor = sendOffsets;
+  for(unsigned i = 0; i < count; i++) {
+    aOut[start + i] = returned[cursor[owners[i]]++];
+  }
+}
+
+
+Vec3 ParticleMesh::Wrap(Vec3 p) const {
+  float half = this->boxSize / 2;
+  p.x -= this->boxSize * std::floor((p.x + half) / this->boxSize);
+  p.y -= this->boxSize * std::floor((p.y + half) / this->boxSize);
+  p.z -= this->boxSize * std::floor((p.z + half) / this->boxSize);
+  return p;
+}
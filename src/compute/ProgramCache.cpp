@@ -0,0 +1,132 @@
+#include "compute/ProgramCache.hpp"
+
+
+// standard
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdint>
+
+
+// Internal
+#include "util/Filesystem.hpp"
+
+
+// Kernel sources embedded by the build (make EMBED_KERNELS=1)
+#ifdef _MPIGRAV_EMBED_KERNELS
+static std::map<std::string, char const*> const embeddedKernels = {
+#include "KernelSources.inc"
+};
+#endif
+
+
+// Load kernel source from the embedded copy, or next to the executable
+std::string LoadKernelSource(std::string const& path) {
+#ifdef _MPIGRAV_EMBED_KERNELS
+  auto embedded = embeddedKernels.find(path);
+  if(embedded != embeddedKernels.end()) return embedded->second;
+#endif
+
+  std::ifstream fp(ExecutableDirectory() + "/" + path);
+  if(!fp) fp.open(path);
+  if(!fp) {
+    std::cout << "Unable to open kernel source: " << path << "\n";
+  }
+  return std::string(
+    (std::istreambuf_iterator<char>(fp)),
+    (std::istreambuf_iterator<char>()));
+}
+
+
+// 64 bit FNV-1a hash
+static uint64_t HashString(std::string const& str, uint64_t hash) {
+  for(unsigned i = 0; i < str.size(); i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+
+ProgramCache::ProgramCache(void) {}
+
+
+ProgramCache::ProgramCache(std::string const& cacheDir) {
+  this->dir = ExpandPath(cacheDir) + "/" + _MPIGRAV_PROGRAM_CACHE_SUBDIR;
+  MakeDirectories(this->dir);
+}
+
+
+std::string ProgramCache::EntryPath(
+  cl::Device const& device,
+  std::string const& source,
+  std::string const& options) {
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = HashString(source, hash);
+  hash = HashString(options, hash);
+  hash = HashString(device.getInfo<CL_DEVICE_NAME>(), hash);
+  hash = HashString(device.getInfo<CL_DRIVER_VERSION>(), hash);
+
+  std::stringstream ss;
+  ss << this->dir << "/" << std::hex << hash << ".bin";
+  return ss.str();
+}
+
+
+// Build a program, trying the cached binary first
+cl::Program ProgramCache::Build(
+  cl::Context const& context,
+  cl::Device const& device,
+  std::string const& source,
+  std::string const& options) {
+
+  std::vector<cl::Device> devices = {device};
+  std::string path;
+  if(!this->dir.empty()) path = this->EntryPath(device, source, options);
+
+  // Cache hit, load the binary
+  std::ifstream in(path, std::ios::binary);
+  if(!path.empty() && in) {
+    cl::Program::Binaries binaries(1);
+    binaries[0].assign(
+      (std::istreambuf_iterator<char>(in)),
+      (std::istreambuf_iterator<char>()));
+    try {
+      cl::Program program(context, devices, binaries);
+      program.build(devices, options.c_str());
+      return program;
+    } catch(cl::Error err) {
+      std::cout << "Discarding stale program binary: " << path << "\n";
+    }
+  }
+
+  // Cache miss, build from source
+  cl::Program program(context, source);
+  try {
+    program.build(devices, options.c_str());
+  } catch(cl::Error err) {
+    std::cout << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n";
+    throw;
+  }
+
+  // Store the binary, written to a temporary so readers never see a partial
+  if(!path.empty()) {
+    cl::Program::Binaries binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+    std::stringstream tmpPath;
+    tmpPath << path << "." << getpid() << ".tmp";
+    std::ofstream out(tmpPath.str(), std::ios::binary);
+    if(!binaries.empty()) {
+      out.write((char const*)binaries[0].data(), binaries[0].size());
+    }
+    out.close();
+    if(binaries.empty() || !out || rename(tmpPath.str().c_str(), path.c_str())) {
+      remove(tmpPath.str().c_str());
+    }
+  }
+
+  return program;
+}
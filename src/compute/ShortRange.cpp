@@ -0,0 +1,21 @@
+#include "compute/ShortRange.hpp"
+
+
+// standard
+#include <sstream>
+
+
+// Parse force law from a command line string
+force_law_t ParseForceLaw(std::string const& str) {
+  if(str == "shifted") return FORCE_SHIFTED;
+  if(str == "screened") return FORCE_SCREENED;
+  return FORCE_TRUNCATED;
+}
+
+
+// Values match the FORCE_* macros in the kernel source
+std::string ForceLawBuildOptions(force_law_t const law) {
+  std::stringstream ss;
+  ss << "-DFORCE_LAW=" << (int)law;
+  return ss.str();
+}
@@ -0,0 +1,165 @@
+#include "compute/Snapshot.hpp"
+
+
+// standard
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+
+// Internal
+#include "compute/MiscMPI.hpp"
+
+
+SnapshotStream::SnapshotStream(
+  MPI_Comm const comm, int const root, bool const velocities) {
+
+  this->comm = comm;
+  this->root = root;
+  this->velocities = velocities;
+  this->simulationTime = 0;
+  this->timestep = 0;
+}
+
+
+// Test rather than block so the root leaves its core to the server threads
+void SnapshotStream::Wait(MPI_Request* request) {
+  int flag = 0;
+  MPI_Test(request, &flag, MPI_STATUS_IGNORE);
+  while(!flag) {
+    std::this_thread::sleep_for(
+      std::chrono::milliseconds(_MPIGRAV_SNAPSHOT_POLL_MS));
+    MPI_Test(request, &flag, MPI_STATUS_IGNORE);
+  }
+}
+
+
+// The previous gather must be done before its buffers are reused, with a
+// few steps between snapshots it normally is
+void SnapshotStream::Send(Universe& universe) {
+  this->Finish();
+  universe.GetDomainBodyData(this->domain);
+
+  // Header first, bodies can be merged away between snapshots
+  this->header[0] = this->domain.size();
+  this->header[1] = universe.GetSimulationTime();
+  this->header[2] = universe.GetTimestepSize();
+  this->requests.resize(2);
+  MPI_Igather(
+    this->header, 3, MPI_DOUBLE, nullptr, 3, MPI_DOUBLE,
+    this->root, this->comm, &this->requests[0]);
+  MPI_Igatherv(
+    this->domain.data(), this->domain.size() * sizeof(Body), MPI_BYTE,
+    nullptr, nullptr, nullptr, MPI_BYTE,
+    this->root, this->comm, &this->requests[1]);
+
+  if(this->velocities) {
+    universe.GetDomainVelocityData(this->domainVelocities);
+    this->requests.resize(3);
+    MPI_Igatherv(
+      this->domainVelocities.data(),
+      this->domainVelocities.size() * sizeof(Vec3), MPI_BYTE,
+      nullptr, nullptr, nullptr, MPI_BYTE,
+      this->root, this->comm, &this->requests[2]);
+  }
+}
+
+
+void SnapshotStream::Send(DensityProjection const& projection) {
+  this->Finish();
+  this->density = projection.Grid();
+
+  this->requests.resize(1);
+  MPI_Ireduce(
+    this->density.data(), nullptr, this->density.size(), MPI_FLOAT,
+    MPI_SUM, this->root, this->comm, &this->requests[0]);
+}
+
+
+// Some mpi implementations only progress nonblocking collectives from
+// inside mpi calls, so poke them once per step
+void SnapshotStream::Poll(void) {
+  if(this->requests.empty()) return;
+
+  int flag;
+  MPI_Testall(
+    this->requests.size(), this->requests.data(), &flag,
+    MPI_STATUSES_IGNORE);
+}
+
+
+void SnapshotStream::Finish(void) {
+  if(this->requests.empty()) return;
+
+  MPI_Waitall(
+    this->requests.size(), this->requests.data(), MPI_STATUSES_IGNORE);
+  this->requests.clear();
+}
+
+
+// Gather one item per body from every rank, counts from the last header
+void SnapshotStream::GatherRoot(void* buffer, size_t const itemSize) {
+  int ranks = RankCount(this->comm);
+  this->rankByteCounts.resize(ranks);
+  this->rankByteOffsets.resize(ranks);
+
+  int total = 0;
+  for(int k = 0; k < ranks; k++) {
+    this->rankByteCounts[k] = this->rankHeaders[3 * k] * itemSize;
+    this->rankByteOffsets[k] = total;
+    total += this->rankByteCounts[k];
+  }
+
+  MPI_Request request;
+  MPI_Igatherv(
+    nullptr, 0, MPI_BYTE,
+    buffer,
+    this->rankByteCounts.data(),
+    this->rankByteOffsets.data(),
+    MPI_BYTE, this->root, this->comm, &request);
+  this->Wait(&request);
+}
+
+
+// Collectives match in the order they're posted, so the root can wait for
+// the headers before posting the gathers the compute ranks already have
+std::vector<Body> const& SnapshotStream::Receive(void) {
+  int ranks = RankCount(this->comm);
+  this->rankHeaders.assign(3 * ranks, 0);
+
+  double none[3] = {0, 0, 0};
+  MPI_Request request;
+  MPI_Igather(
+    none, 3, MPI_DOUBLE, this->rankHeaders.data(), 3, MPI_DOUBLE,
+    this->root, this->comm, &request);
+  this->Wait(&request);
+
+  // Every compute rank keeps the same clock, take the first one's
+  unsigned count = 0;
+  for(int k = 0; k < ranks; k++) count += this->rankHeaders[3 * k];
+  int first = this->root ? 0 : 1;
+  this->simulationTime = this->rankHeaders[(3 * first) + 1];
+  this->timestep = this->rankHeaders[(3 * first) + 2];
+
+  this->bodies.resize(count);
+  this->GatherRoot(this->bodies.data(), sizeof(Body));
+  if(this->velocities) {
+    this->bodyVelocities.resize(count);
+    this->GatherRoot(this->bodyVelocities.data(), sizeof(Vec3));
+  }
+
+  return this->bodies;
+}
+
+
+// The root's own contribution is an empty grid
+void SnapshotStream::Receive(DensityProjection& projection) {
+  std::vector<float>& grid = projection.Grid();
+  std::fill(grid.begin(), grid.end(), 0.0f);
+
+  MPI_Request request;
+  MPI_Ireduce(
+    MPI_IN_PLACE, grid.data(), grid.size(), MPI_FLOAT,
+    MPI_SUM, this->root, this->comm, &request);
+  this->Wait(&request);
+}
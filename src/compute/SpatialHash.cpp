@@ -0,0 +1,69 @@
+#include "compute/SpatialHash.hpp"
+
+
+// External
+#include "omp.h"
+
+
+SpatialHash::SpatialHash(float const cellSize) :
+  cellInverse(1 / cellSize), tableMask(0) {}
+
+
+// Counting sort of bodies into buckets
+void SpatialHash::Build(Vec3 const* r, unsigned const count) {
+
+  // Table is the next power of two up from the body count
+  unsigned tableSize = 1;
+  while(tableSize < count) tableSize <<= 1;
+  this->tableMask = tableSize - 1;
+
+  this->bucketStart.assign(tableSize + 1, 0);
+  this->bucketBodies.resize(count);
+  std::vector<unsigned> bodyBucket(count);
+
+  // Count bodies per bucket
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < count; i++) {
+    unsigned b = this->Bucket(
+      this->Cell(r[i].x), this->Cell(r[i].y), this->Cell(r[i].z));
+    bodyBucket[i] = b;
+    #pragma omp atomic
+    this->bucketStart[b + 1]++;
+  }
+
+  // Prefix sum, each thread sums a block then offsets it
+  int threadCount = omp_get_max_threads();
+  std::vector<unsigned> blockTotals(threadCount + 1, 0);
+  #pragma omp parallel
+  {
+    int t = omp_get_thread_num();
+    int n = omp_get_num_threads();
+    unsigned blockSize = (tableSize + n - 1) / n;
+    unsigned start = 1 + (t * blockSize);
+    unsigned end = std::min(tableSize + 1, start + blockSize);
+
+    for(unsigned b = start + 1; b < end; b++) {
+      this->bucketStart[b] += this->bucketStart[b - 1];
+    }
+    if(start < end) blockTotals[t + 1] = this->bucketStart[end - 1];
+
+    #pragma omp barrier
+    #pragma omp single
+    for(int k = 1; k <= n; k++) blockTotals[k] += blockTotals[k - 1];
+
+    for(unsigned b = start; b < end; b++) {
+      this->bucketStart[b] += blockTotals[t];
+    }
+  }
+
+  // Scatter bodies into place
+  std::vector<unsigned> cursor(
+    this->bucketStart.begin(), this->bucketStart.end() - 1);
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = 0; i < count; i++) {
+    unsigned slot;
+    #pragma omp atomic capture
+    slot = cursor[bodyBucket[i]]++;
+    this->bucketBodies[slot] = i;
+  }
+}
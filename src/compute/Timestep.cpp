@@ -0,0 +1,42 @@
+#include "compute/Timestep.hpp"
+
+
+// standard
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+
+TimestepController::TimestepController(
+  float const courant, float const dtMin, float const dtMax) :
+  courant(courant), dtMin(dtMin), dtMax(dtMax), tauPrevious(0) {}
+
+
+float TimestepController::Next(
+  float const dt, float const e, float const aMax, float const jMax) {
+
+  // Time to cross the softening length from rest, & the acceleration's
+  // own timescale when the jerk is known
+  float tau = std::numeric_limits<float>::infinity();
+  if(aMax > 0 && e > 0) {
+    tau = std::min(tau, this->courant * std::sqrt(e / aMax));
+  }
+  if(aMax > 0 && jMax > 0) {
+    tau = std::min(tau, this->courant * aMax / jMax);
+  }
+  if(std::isinf(tau)) return dt;
+
+  // Extrapolate to the middle of the coming step
+  float tauMid = tau;
+  if(this->tauPrevious > 0) {
+    tauMid = std::max((1.5f * tau) - (0.5f * this->tauPrevious), tau / 2);
+  }
+  this->tauPrevious = tau;
+
+  float next = std::min(
+    std::max(tauMid, dt / _MPIGRAV_TIMESTEP_MAX_CHANGE),
+    dt * _MPIGRAV_TIMESTEP_MAX_CHANGE);
+  next = std::max(next, this->dtMin);
+  if(this->dtMax > 0) next = std::min(next, this->dtMax);
+  return next;
+}
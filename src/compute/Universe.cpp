@@ -3,62 +3,142 @@
 
 // standard
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
 
 
 // External
 #include "mpi.h"
 #include "omp.h"
 #include "compute/MiscMPI.hpp"
+#include "util/Filesystem.hpp"
+#include "compute/SpatialHash.hpp"
+
+
+// Parse compute engine from a command line string
+engine_t ParseEngine(std::string const& str) {
+  if(str == "cpu") return ENGINE_CPU;
+  if(str == "symmetric") return ENGINE_CPU_SYMMETRIC;
+  if(str == "pm") return ENGINE_PM;
+  return ENGINE_OPENCL;
+}
+
+
+// Only the plain cpu & opencl engines take integrator policies, the rest
+// are fused around the leapfrog update
+bool SupportsIntegrator(engine_t const engine, UniverseConfig const& config) {
+  if(config.integrator == INTEGRATOR_LEAPFROG) return true;
+  if(config.overlapExchange) return false;
+  return engine == ENGINE_CPU || engine == ENGINE_OPENCL;
+}
+
+
+// Short range forces replace the cpu & opencl force loops, which don't
+// give the jerk hermite needs. Halos are exchanged per rank, not per node.
+bool SupportsShortRange(engine_t const engine, UniverseConfig const& config) {
+  if(config.cutoff <= 0) return true;
+  if(config.integrator == INTEGRATOR_HERMITE) return false;
+  if(config.overlapExchange || config.sharedMemory) return false;
+  return engine == ENGINE_CPU || engine == ENGINE_OPENCL;
+}
 
 
 // Constructs a universe from vector of bodies
 Universe::Universe(
   std::vector<Body> const& bodyData,
-  float const G, float const dt, float const e) {
+  float const G, float const dt, float const e,
+  UniverseConfig const& config) {
 
+  this->config = config;
+  this->comm = config.comm;
   this->bodyCount = bodyData.size();
+  this->capacity = this->bodyCount;
+  this->tracerCount = 0;
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    if(bodyData[i].m == 0) this->tracerCount++;
+  }
+  this->sourceCount = this->bodyCount - this->tracerCount;
+  this->forcesPrimed = false;
+  this->forceEvaluations = 0;
+  this->timestep = TimestepController(
+    config.courant, config.dtMin, config.dtMax);
+  this->accelerationMax2 = 0;
+  this->jerkMax2 = 0;
+  this->nodeComm = MPI_COMM_NULL;
+  this->leaderComm = MPI_COMM_NULL;
+  this->nodeWindow = MPI_WIN_NULL;
+  this->createdCount = this->bodyCount;
+  this->cellCapacity = 0;
+  this->cellTableCapacity = 0;
+  this->hostStale = false;
+  this->deviceStale = true;
+  this->residentPending = 0;
+  this->simulationTime = 0;
+  this->stepsSinceReorder = 0;
+  this->bodyIds.resize(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) this->bodyIds[i] = i;
+  this->bodyIndex = this->bodyIds;
+  this->storageOrdered = true;
+
+  // Compute work assignments
+  if(this->config.sharedMemory) this->SplitNodes();
+  this->DistributeWork();
 
   // Allocate integrator term buffers
-  this->m = new float[bodyData.size()];
-  this->v = new Vec3[bodyData.size()];
-  this->r = new Vec3[bodyData.size()];
-  this->a = new Vec3[bodyData.size()];
-  this->rNext = new Vec3[bodyData.size()];
-  this->vNext = new Vec3[bodyData.size()];
-  this->aNext = new Vec3[bodyData.size()];
+  if(this->config.pinThreads) PinThreads();
+  this->AllocateStorage();
 
-  // Initialise position and mass
-  for(unsigned i = 0; i < bodyData.size(); i++) {
-    this->m[i] = bodyData[i].m;
-    this->r[i] = bodyData[i].r;
+  // Each domain takes the next of the sources & tracers in the order given
+  std::vector<unsigned> placement;
+  std::vector<unsigned> sources;
+  std::vector<unsigned> tracers;
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    if(bodyData[i].m == 0) tracers.push_back(i);
+    else sources.push_back(i);
+  }
+  unsigned nextSource = 0;
+  unsigned nextTracer = 0;
+  for(int k = 0; k < RankCount(this->comm); k++) {
+    unsigned domainTracers =
+      this->rankBodyCounts[k] - this->rankSourceCounts[k];
+    for(unsigned n = 0; n < this->rankSourceCounts[k]; n++) {
+      placement.push_back(sources[nextSource++]);
+    }
+    for(unsigned n = 0; n < domainTracers; n++) {
+      placement.push_back(tracers[nextTracer++]);
+    }
   }
 
-  // Compute work assignments
-  unsigned localBodyCount;
-  unsigned domainOffset = 0;
-  unsigned localBodyRemainder = bodyData.size() % RankCount();
-  for(int i = 0; i < RankCount(); i++) {
-    localBodyCount = bodyData.size() / RankCount();
-    if(localBodyRemainder) {
-      localBodyCount++;
-      localBodyRemainder--;
-    }
-    this->rankBodyCounts.push_back(localBodyCount);
-    this->rankBodyOffsets.push_back(domainOffset);
-    domainOffset += localBodyCount;
+  // Initialise position and mass
+  if(this->NodeLeader()) {
+    #pragma omp parallel for schedule(static)
+    for(unsigned i = 0; i < bodyData.size(); i++) {
+      this->m[i] = bodyData[placement[i]].m;
+      this->r[i] = bodyData[placement[i]].r;
+    }
   }
+  this->NodeBarrier();
 
   // Print out work assignments
-  if(MyRank() == 0) {
+  if(MyRank(this->comm) == 0) {
     std::cout << "\n[WORK DISTRIBUTION]\n";
-    for(int i = 0; i < RankCount(); i++) {
+    for(int i = 0; i < RankCount(this->comm); i++) {
       std::cout << "Process " << i << ") offset: " << this->rankBodyOffsets[i];
-      std::cout << ", count: " << this->rankBodyCounts[i] << "\n";
+      std::cout << ", count: " << this->rankBodyCounts[i];
+      if(this->tracerCount) {
+        std::cout << ", sources: " << this->rankSourceCounts[i];
+      }
+      std::cout << "\n";
     }
   }
 
+  // Simulation parameters, needed to set kernel arguments
+  this->G = G;
+  this->dt = dt;
+  this->e = e;
+
   // Initialise opencl stuff
   try {
     this->InitCL();
@@ -67,15 +147,221 @@ Universe::Universe(
     exit(1);
   }
 
-  this->SetGravitationalConstant(G);
-  this->SetTimestepSize(dt);
-  this->SetSofteningFactor(e);
+  // Short range domains need to be compact in space, see Reorder()
+  if(this->config.cutoff > 0) this->Reorder();
+}
+
+
+// Split sources & tracers evenly between ranks in contiguous domains
+void Universe::DistributeWork(void) {
+  int ranks = RankCount(this->comm);
+  std::vector<unsigned> sourceCounts(ranks);
+  std::vector<unsigned> tracerCounts(ranks);
+
+  for(int i = 0; i < ranks; i++) {
+    sourceCounts[i] = this->sourceCount / ranks;
+    if((unsigned)i < this->sourceCount % ranks) sourceCounts[i]++;
+    tracerCounts[i] = this->tracerCount / ranks;
+    if((unsigned)i < this->tracerCount % ranks) tracerCounts[i]++;
+  }
+
+  this->AssignDomains(sourceCounts, tracerCounts);
+}
+
+
+// Lay domains out in rank order, each one's sources then its tracers
+void Universe::AssignDomains(
+  std::vector<unsigned> const& sourceCounts,
+  std::vector<unsigned> const& tracerCounts) {
+
+  this->rankBodyCounts.clear();
+  this->rankBodyOffsets.clear();
+  this->rankSourceCounts = sourceCounts;
+  this->sourceRanges.clear();
+
+  unsigned domainOffset = 0;
+  for(int i = 0; i < RankCount(this->comm); i++) {
+    this->rankBodyCounts.push_back(sourceCounts[i] + tracerCounts[i]);
+    this->rankBodyOffsets.push_back(domainOffset);
+
+    // Without tracers the sources form a single range
+    unsigned sourceEnd = domainOffset + sourceCounts[i];
+    if(!this->sourceRanges.empty() &&
+       this->sourceRanges.back() == domainOffset) {
+      this->sourceRanges.back() = sourceEnd;
+    } else if(sourceCounts[i]) {
+      this->sourceRanges.push_back(domainOffset);
+      this->sourceRanges.push_back(sourceEnd);
+    }
+    domainOffset += this->rankBodyCounts[i];
+  }
+
+  // Domains are grouped by node, so each node's are contiguous
+  if(this->config.sharedMemory) {
+    unsigned nodeCount = this->rankNodes.back() + 1;
+    this->nodeBodyCounts.assign(nodeCount, 0);
+    this->nodeBodyOffsets.assign(nodeCount, this->bodyCount);
+    for(int i = 0; i < RankCount(this->comm); i++) {
+      int node = this->rankNodes[i];
+      this->nodeBodyCounts[node] += this->rankBodyCounts[i];
+      this->nodeBodyOffsets[node] = std::min(
+        this->nodeBodyOffsets[node], this->rankBodyOffsets[i]);
+    }
+  }
+
+  // Every rank holds all positions at this point, nothing to wait for
+  this->landedSlices.clear();
+  for(int i = 0; i < RankCount(this->comm); i++) {
+    if(i != MyRank(this->comm)) this->landedSlices.push_back(i);
+  }
+}
+
+
+// Carve the integrator term buffers out of one arena. Pages are placed on
+// first touch, so this rank's domain is zeroed with the same static
+// schedule the compute loops use & each thread's bodies land on its node
+void Universe::AllocateStorage(void) {
+  size_t const align = 64;
+  size_t floatBytes =
+    ((this->capacity * sizeof(float) + align - 1) / align) * align;
+  size_t vecBytes =
+    ((this->capacity * sizeof(Vec3) + align - 1) / align) * align;
+  size_t bytes = floatBytes + (8 * vecBytes);
+
+  char* p;
+  if(this->config.sharedMemory) {
+    p = (char*)this->AllocateShared(bytes);
+  } else {
+    this->storage = Arena(bytes, this->config.hugePages);
+    p = (char*)this->storage.Data();
+  }
+  this->m = (float*)p; p += floatBytes;
+  this->r = (Vec3*)p; p += vecBytes;
+  this->v = (Vec3*)p; p += vecBytes;
+  this->a = (Vec3*)p; p += vecBytes;
+  this->rNext = (Vec3*)p; p += vecBytes;
+  this->vNext = (Vec3*)p; p += vecBytes;
+  this->aNext = (Vec3*)p; p += vecBytes;
+  this->j = (Vec3*)p; p += vecBytes;
+  this->jNext = (Vec3*)p;
+
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainEnd = this->GetDomainEnd();
+
+  // With shared buffers the rest of the node is touched by its own ranks
+  unsigned localStart = domainStart;
+  unsigned localEnd = domainEnd;
+  if(this->config.sharedMemory) {
+    int node = this->rankNodes[MyRank(this->comm)];
+    localStart = this->nodeBodyOffsets[node];
+    localEnd = localStart + this->nodeBodyCounts[node];
+  }
+  bool leader = this->NodeLeader();
+
+  #pragma omp parallel
+  {
+    // Bodies this rank integrates
+    #pragma omp for schedule(static)
+    for(unsigned i = domainStart; i < domainEnd; i++) {
+      this->m[i] = 0;
+      this->r[i] = this->v[i] = this->a[i] = Vec3(0, 0, 0);
+      this->rNext[i] = this->vNext[i] = this->aNext[i] = Vec3(0, 0, 0);
+      this->j[i] = this->jNext[i] = Vec3(0, 0, 0);
+    }
+
+    // Bodies owned elsewhere are read by every thread, spread them out
+    #pragma omp for schedule(static)
+    for(unsigned i = 0; i < this->capacity; i++) {
+      if(!leader || (i >= localStart && i < localEnd)) continue;
+      this->m[i] = 0;
+      this->r[i] = this->v[i] = this->a[i] = Vec3(0, 0, 0);
+      this->rNext[i] = this->vNext[i] = this->aNext[i] = Vec3(0, 0, 0);
+      this->j[i] = this->jNext[i] = Vec3(0, 0, 0);
+    }
+  }
+  this->NodeBarrier();
+}
+
+
+// The communicators besides config.comm were made by SplitNodes()
+Universe::~Universe(void) {
+  int finalized;
+  MPI_Finalized(&finalized);
+  if(finalized) return;
+
+  if(this->nodeWindow != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(this->nodeWindow);
+    MPI_Win_free(&this->nodeWindow);
+  }
+  if(this->leaderComm != MPI_COMM_NULL) MPI_Comm_free(&this->leaderComm);
+  if(this->nodeComm != MPI_COMM_NULL) MPI_Comm_free(&this->nodeComm);
+  if(this->comm != this->config.comm) MPI_Comm_free(&this->comm);
+}
+
+
+//====[NODE SHARED BUFFERS]==================================================//
+
+// Group ranks by node so that each node's domains are contiguous, then
+// pick the lowest rank on each node to lead the inter-node exchange
+void Universe::SplitNodes(void) {
+  MPI_Comm_split_type(
+    this->comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &this->nodeComm);
+  int nodeRank = MyRank(this->nodeComm);
+  int leader = MyRank(this->comm);
+  MPI_Bcast(&leader, 1, MPI_INT, 0, this->nodeComm);
+
+  MPI_Comm grouped;
+  MPI_Comm_split(
+    this->comm, 0, (leader * RankCount(this->comm)) + nodeRank, &grouped);
+  this->comm = grouped;
+  MPI_Comm_split(
+    this->comm, nodeRank ? MPI_UNDEFINED : 0, MyRank(this->comm),
+    &this->leaderComm);
+
+  // Node index of every rank, nodes are numbered in rank order
+  int node = nodeRank ? 0 : MyRank(this->leaderComm);
+  MPI_Bcast(&node, 1, MPI_INT, 0, this->nodeComm);
+  this->rankNodes.resize(RankCount(this->comm));
+  MPI_Allgather(
+    &node, 1, MPI_INT, this->rankNodes.data(), 1, MPI_INT, this->comm);
+}
+
+
+// One copy of the buffers per node, allocated by the leader & mapped by
+// the other ranks on the node. Huge page options don't apply here.
+void* Universe::AllocateShared(size_t const bytes) {
+  void* base;
+  MPI_Win_allocate_shared(
+    MyRank(this->nodeComm) ? 0 : bytes, 1, MPI_INFO_NULL,
+    this->nodeComm, &base, &this->nodeWindow);
+
+  MPI_Aint size;
+  int unit;
+  MPI_Win_shared_query(this->nodeWindow, 0, &size, &unit, &base);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, this->nodeWindow);
+  return base;
+}
+
+
+// Whether this rank writes state which the whole node reads, i.e. always
+// unless buffers are shared & another rank leads the node
+bool Universe::NodeLeader(void) {
+  return !this->config.sharedMemory || !MyRank(this->nodeComm);
+}
+
+
+// Make writes to shared buffers visible to the rest of the node
+void Universe::NodeBarrier(void) {
+  if(!this->config.sharedMemory) return;
+  MPI_Win_sync(this->nodeWindow);
+  MPI_Barrier(this->nodeComm);
+  MPI_Win_sync(this->nodeWindow);
 }
 
 
 // Initialise opencl, horrible routine, will need to clean up
 void Universe::InitCL(void) {
-  if(!MyRank()) std::cout << "\n[OPENCL INITIALISATION]\n";
+  if(!MyRank(this->comm)) std::cout << "\n[OPENCL INITIALISATION]\n";
 
   // Get list of platforms
   std::vector<cl::Platform> clPlatforms;
@@ -95,38 +381,98 @@ void Universe::InitCL(void) {
   // SELECT DEVICE HERE
 
   // Create a command queue
-  this->clCommandQueue = cl::CommandQueue(this->clContext, clDevices[0]);
+  this->clDevice = clDevices[0];
+  this->clCommandQueue = cl::CommandQueue(this->clContext, this->clDevice);
+
+  // Create opencl buffers
+  this->domainCapacity = this->GetDomainSize();
+  this->AllocateBuffersCL();
 
-  // Load kernel source
-  std::ifstream fp("kernels/leapfrog.cl");
-  std::string source(
-    (std::istreambuf_iterator<char>(fp)),
-    (std::istreambuf_iterator<char>()));
+  // Build the kernel with the default launch configuration
+  this->clSource = LoadKernelSource(_MPIGRAV_LEAPGROG_KERNEL_PATH);
+  this->clProgramCache = ProgramCache(this->config.cacheDir);
+  this->BuildKernelNodeOrdered(this->clKernelConfig);
+}
 
-  // Make context-local program from source & build for devices
-  this->clProgram = cl::Program(this->clContext, source);
-  this->clProgram.build(clDevices);
 
-  // Build the kernel
-  this->clKernel = cl::Kernel(this->clProgram, "leapfrog");
+// Create the opencl buffers at the current capacities, buffers can't be
+// empty so there's always room for at least one body
+void Universe::AllocateBuffersCL(void) {
+  size_t inputCount = std::max(this->capacity, 1u);
+  size_t outputCount = std::max(this->domainCapacity, 1u);
 
-  // Create opencl buffers (input)
+  // Create opencl buffers (input), state buffers are also written as
+  // resident steps swap them with the outputs
   this->clBuf_m = cl::Buffer(
-    this->clContext, CL_MEM_READ_ONLY, this->bodyCount * sizeof(float));
+    this->clContext, CL_MEM_READ_ONLY, inputCount * sizeof(float));
   this->clBuf_r = cl::Buffer(
-    this->clContext, CL_MEM_READ_ONLY, this->bodyCount * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, inputCount * sizeof(Vec3));
   this->clBuf_v = cl::Buffer(
-    this->clContext, CL_MEM_READ_ONLY, this->bodyCount * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, inputCount * sizeof(Vec3));
   this->clBuf_a = cl::Buffer(
-    this->clContext, CL_MEM_READ_ONLY, this->bodyCount * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, inputCount * sizeof(Vec3));
 
   // Create opencl buffers (output)
   this->clBuf_rNext = cl::Buffer(
-    this->clContext, CL_MEM_WRITE_ONLY, this->GetDomainSize() * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, outputCount * sizeof(Vec3));
   this->clBuf_vNext = cl::Buffer(
-    this->clContext, CL_MEM_WRITE_ONLY, this->GetDomainSize() * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, outputCount * sizeof(Vec3));
   this->clBuf_aNext = cl::Buffer(
-    this->clContext, CL_MEM_WRITE_ONLY, this->GetDomainSize() * sizeof(Vec3));
+    this->clContext, CL_MEM_READ_WRITE, outputCount * sizeof(Vec3));
+  this->clBuf_jNext = cl::Buffer(
+    this->clContext, CL_MEM_READ_WRITE, outputCount * sizeof(Vec3));
+
+  // One |a|^2 maximum per work group, sized for the smallest groups
+  this->clBuf_aMax2 = cl::Buffer(
+    this->clContext, CL_MEM_WRITE_ONLY, (outputCount + 1) * sizeof(float));
+}
+
+
+// Build the kernel for the given launch configuration
+void Universe::BuildKernel(KernelConfig const& config, bool const cached) {
+
+  // Get program for this device, from the binary cache if possible, an
+  // uncached build uses a cache with no directory
+  std::string options =
+    config.BuildOptions() + " " +
+    IntegratorBuildOptions(this->config.integrator) + " " +
+    ForceLawBuildOptions(this->config.forceLaw);
+  ProgramCache uncached;
+  ProgramCache& cache = cached ? this->clProgramCache : uncached;
+  this->clProgram = cache.Build(
+    this->clContext, this->clDevice, this->clSource, options);
+
+  // Build the kernels
+  this->clKernel = cl::Kernel(this->clProgram, "leapfrog");
+  this->clKernelAccumulate = cl::Kernel(this->clProgram, "accumulate");
+  this->clKernelIntegrate = cl::Kernel(this->clProgram, "integrate");
+  this->clKernelCells = cl::Kernel(this->clProgram, "accumulate_cells");
+  this->clKernelConfig = config;
+
+  // Set kernel arguments (parameters)
+  this->clKernel.setArg(7, this->dt);
+  this->clKernel.setArg(8, this->G);
+  this->clKernel.setArg(9, this->e * this->e);
+  this->clKernelAccumulate.setArg(3, this->e * this->e);
+  this->clKernelIntegrate.setArg(6, this->dt);
+  this->clKernelIntegrate.setArg(7, this->G);
+
+  // Short range kernel, cell lists are set per launch
+  ShortRangeParams p(
+    this->config.cutoff, this->e, this->config.screeningLength);
+  this->clKernelCells.setArg(7, p.e2);
+  this->clKernelCells.setArg(8, p.cutoff2);
+  this->clKernelCells.setArg(9, p.shift);
+  this->clKernelCells.setArg(10, p.screeningInverse);
+
+  this->SetKernelBufferArgs();
+  this->SetKernelDomainArgs();
+}
+
+
+// Point the kernels at the current buffers, which are replaced when they
+// outgrow their capacity
+void Universe::SetKernelBufferArgs(void) {
 
   // Set kernel arguments (input)
   this->clKernel.setArg(0, this->clBuf_m);
@@ -138,11 +484,176 @@ void Universe::InitCL(void) {
   this->clKernel.setArg(4, this->clBuf_rNext);
   this->clKernel.setArg(5, this->clBuf_vNext);
   this->clKernel.setArg(6, this->clBuf_aNext);
+  this->clKernel.setArg(13, this->clBuf_aMax2);
+
+  // Split step kernels, source range is set per launch
+  this->clKernelAccumulate.setArg(0, this->clBuf_m);
+  this->clKernelAccumulate.setArg(1, this->clBuf_r);
+  this->clKernelAccumulate.setArg(2, this->clBuf_aNext);
+  this->clKernelAccumulate.setArg(9, this->clBuf_v);
+  this->clKernelAccumulate.setArg(10, this->clBuf_jNext);
+
+  this->clKernelIntegrate.setArg(0, this->clBuf_r);
+  this->clKernelIntegrate.setArg(1, this->clBuf_v);
+  this->clKernelIntegrate.setArg(2, this->clBuf_a);
+  this->clKernelIntegrate.setArg(3, this->clBuf_rNext);
+  this->clKernelIntegrate.setArg(4, this->clBuf_vNext);
+  this->clKernelIntegrate.setArg(5, this->clBuf_aNext);
+
+  this->clKernelCells.setArg(0, this->clBuf_r);
+  this->clKernelCells.setArg(1, this->clBuf_aNext);
+}
+
 
-  // Set kernel arguments (misc)
+// Set kernel arguments describing the body count & this rank's domain
+void Universe::SetKernelDomainArgs(void) {
   int domainOffset = this->GetDomainStart();
+  int domainSize = this->GetDomainSize();
+
   this->clKernel.setArg(10, this->bodyCount);
   this->clKernel.setArg(11, domainOffset);
+  this->clKernel.setArg(12, domainSize);
+
+  this->clKernelAccumulate.setArg(4, domainOffset);
+  this->clKernelAccumulate.setArg(5, domainSize);
+
+  this->clKernelIntegrate.setArg(8, domainOffset);
+  this->clKernelIntegrate.setArg(9, domainSize);
+
+  this->clKernelCells.setArg(11, domainOffset);
+  this->clKernelCells.setArg(12, domainSize);
+}
+
+
+// Build the kernel on all ranks, the first rank on each node goes first
+// so that the rest of the node loads the binary it leaves in the cache
+void Universe::BuildKernelNodeOrdered(KernelConfig const& config) {
+  MPI_Comm nodeComm;
+  MPI_Comm_split_type(
+    this->comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm);
+
+  if(MyRank(nodeComm) == 0) this->BuildKernel(config);
+  MPI_Barrier(nodeComm);
+  if(MyRank(nodeComm) != 0) this->BuildKernel(config);
+
+  MPI_Comm_free(&nodeComm);
+}
+
+
+// Number of work groups a tiled kernel is launched with
+unsigned Universe::GroupCount(void) {
+  unsigned groupSize = this->clKernelConfig.workGroupSize;
+  unsigned bodiesPerItem = this->clKernelConfig.bodiesPerItem;
+  unsigned items = (this->GetDomainSize() + bodiesPerItem - 1) / bodiesPerItem;
+  return (items + groupSize - 1) / groupSize;
+}
+
+
+// Enqueue a tiled kernel over this rank's domain
+void Universe::EnqueueKernel(cl::Kernel const& kernel) {
+  unsigned groupSize = this->clKernelConfig.workGroupSize;
+  unsigned groups = this->GroupCount();
+
+  cl::NDRange globalWork = groups * groupSize;
+  cl::NDRange localWork = groupSize;
+  this->clCommandQueue.enqueueNDRangeKernel(
+    kernel, cl::NullRange, globalWork, localWork);
+}
+
+
+// Whether opencl steps launch the fused kernel, rather than an accumulate
+// per force evaluation or the short range kernel
+bool Universe::FusedCL(void) {
+  return
+    this->config.integrator == INTEGRATOR_LEAPFROG &&
+    !this->config.overlapExchange &&
+    this->config.cutoff <= 0 &&
+    !this->tracerCount;
+}
+
+
+// Time the kernel with a given launch configuration, launched as a step
+// would, returns the best of several runs or infinity if it fails
+double Universe::BenchmarkKernel(KernelConfig const& config) {
+  auto launch = [this](void) {
+    if(this->FusedCL()) {
+      this->EnqueueKernel(this->clKernel);
+      return;
+    }
+    for(unsigned n = 0; n < this->sourceRanges.size(); n += 2) {
+      this->EnqueueAccumulate(
+        this->sourceRanges[n],
+        this->sourceRanges[n + 1] - this->sourceRanges[n], n == 0);
+    }
+  };
+
+  double tBest = std::numeric_limits<double>::infinity();
+  try {
+    this->BuildKernel(config, false);
+    launch();
+    this->clCommandQueue.finish();
+
+    for(int i = 0; i < 3; i++) {
+      double tStart = MPI_Wtime();
+      launch();
+      this->clCommandQueue.finish();
+      tBest = std::min(tBest, MPI_Wtime() - tStart);
+    }
+  } catch(cl::Error err) {
+    std::cout << "  " << config.Str() << ") failed: " << err.what() << "\n";
+  }
+  return tBest;
+}
+
+
+// Select kernel launch parameters for this device & problem size
+// Rank 0 consults the cache (tuning on a miss) and the result is shared.
+// The short range kernel has no tiles, so cutoff runs keep the defaults.
+void Universe::TuneCL(tuning_mode_t const mode) {
+  KernelConfig config;
+
+  if(mode != TUNING_OFF && this->config.cutoff <= 0 &&
+     !MyRank(this->comm)) {
+    std::string dir = ExpandPath(this->config.cacheDir);
+    MakeDirectories(dir);
+    TuningCache cache(dir + "/" + _MPIGRAV_TUNING_CACHE_FILE);
+    std::string variant =
+      std::string(this->FusedCL() ? "leapfrog " : "accumulate ") +
+      IntegratorBuildOptions(this->config.integrator) + " " +
+      ForceLawBuildOptions(this->config.forceLaw);
+    std::string key = TuningCache::Key(
+      this->clDevice.getInfo<CL_DEVICE_NAME>(),
+      this->clDevice.getInfo<CL_DRIVER_VERSION>(),
+      variant, this->GetDomainSize(), this->sourceCount);
+
+    unsigned maxGroupSize =
+      this->clDevice.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    unsigned long localMem =
+      this->clDevice.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    bool jerk = this->config.integrator == INTEGRATOR_HERMITE;
+    auto fits = [&](KernelConfig const& c) {
+      return c.Fits(maxGroupSize, localMem, jerk);
+    };
+
+    // Entries this device can't run are retuned from the defaults
+    if(mode == TUNING_FORCE || !cache.Lookup(key, config) || !fits(config)) {
+      std::cout << "\n[KERNEL AUTOTUNING]\n";
+      this->WriteInputBuffers();
+
+      KernelTuner tuner;
+      config = tuner.Tune(KernelConfig(), fits,
+        [&](KernelConfig const& c) { return this->BenchmarkKernel(c); });
+      cache.Store(key, config);
+    }
+  }
+
+  // Everyone uses the configuration chosen by rank 0
+  MPI_Bcast(&config, sizeof(KernelConfig), MPI_BYTE, 0, this->comm);
+  this->BuildKernelNodeOrdered(config);
+
+  if(!MyRank(this->comm)) {
+    std::cout << "Kernel configuration: " << config.Str() << "\n";
+  }
 }
 
 
@@ -152,67 +663,116 @@ void Universe::SwapBuffers(void) {
   tmp = this->r; this->r = this->rNext; this->rNext = tmp;
   tmp = this->v; this->v = this->vNext; this->vNext = tmp;
   tmp = this->a; this->a = this->aNext; this->aNext = tmp;
+  tmp = this->j; this->j = this->jNext; this->jNext = tmp;
+}
+
+
+// Swaps the device state buffers, a single rank's outputs line up with its
+// inputs so the next launch can read them where they are
+void Universe::SwapBuffersCL(void) {
+  std::swap(this->clBuf_r, this->clBuf_rNext);
+  std::swap(this->clBuf_v, this->clBuf_vNext);
+  std::swap(this->clBuf_a, this->clBuf_aNext);
+  this->SetKernelBufferArgs();
 }
 
 
 // Synchronize buffers between processes
 void Universe::Synchronize(void) {
-  if(RankCount() == 1) return;
+  if(RankCount(this->comm) == 1) return;
+
+  this->AllgatherDomain(this->r);
+  this->AllgatherDomain(this->v);
+  this->AllgatherDomain(this->a);
+}
+
+
+// Share each rank's sources of a body buffer with every other rank
+void Universe::AllgatherDomain(Vec3* buffer) {
+  if(RankCount(this->comm) == 1) return;
+  if(this->config.sharedMemory) {
+    this->AllgatherNodes(buffer);
+    return;
+  }
 
   std::vector<int> rankByteCounts(rankBodyCounts.size());
   std::vector<int> rankByteOffsets(rankBodyOffsets.size());
 
   for(unsigned i = 0; i < rankByteCounts.size(); i++) {
-    rankByteCounts[i] = this->rankBodyCounts[i] * sizeof(Vec3);
+    rankByteCounts[i] = this->rankSourceCounts[i] * sizeof(Vec3);
     rankByteOffsets[i] = this->rankBodyOffsets[i] * sizeof(Vec3);
   }
 
-  // Synchronize positions
   MPI_Allgatherv(
-    &this->r[this->GetDomainStart()],
-    this->GetDomainSize() * sizeof(Vec3),
-    MPI_BYTE, this->r,
+    MPI_IN_PLACE, 0, MPI_BYTE, buffer,
     rankByteCounts.data(),
     rankByteOffsets.data(),
-    MPI_BYTE, MPI_COMM_WORLD);
+    MPI_BYTE, this->comm);
+}
 
-  // Synchronize velocity
-  MPI_Allgatherv(
-    &this->v[this->GetDomainStart()],
-    this->GetDomainSize() * sizeof(Vec3),
-    MPI_BYTE, this->v,
-    rankByteCounts.data(),
-    rankByteOffsets.data(),
-    MPI_BYTE, MPI_COMM_WORLD);
 
-  // Synchronize acceleration
-  MPI_Allgatherv(
-    &this->a[this->GetDomainStart()],
-    this->GetDomainSize() * sizeof(Vec3),
-    MPI_BYTE, this->a,
-    rankByteCounts.data(),
-    rankByteOffsets.data(),
-    MPI_BYTE, MPI_COMM_WORLD);
+// Shared buffers only need whole nodes' sources exchanged between leaders,
+// the rest of the node waits for them. Tracers split a node's sources up,
+// each rank's are then broadcast by its node's leader.
+void Universe::AllgatherNodes(Vec3* buffer) {
+  this->NodeBarrier();
+
+  bool exchange =
+    this->leaderComm != MPI_COMM_NULL && RankCount(this->leaderComm) > 1;
+  if(exchange && this->tracerCount) {
+    std::vector<MPI_Request> requests(RankCount(this->comm));
+    for(int k = 0; k < RankCount(this->comm); k++) {
+      MPI_Ibcast(
+        &buffer[this->rankBodyOffsets[k]],
+        this->rankSourceCounts[k] * sizeof(Vec3),
+        MPI_BYTE, this->rankNodes[k], this->leaderComm, &requests[k]);
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  } else if(exchange) {
+    std::vector<int> nodeByteCounts(this->nodeBodyCounts.size());
+    std::vector<int> nodeByteOffsets(this->nodeBodyOffsets.size());
+
+    for(unsigned i = 0; i < nodeByteCounts.size(); i++) {
+      nodeByteCounts[i] = this->nodeBodyCounts[i] * sizeof(Vec3);
+      nodeByteOffsets[i] = this->nodeBodyOffsets[i] * sizeof(Vec3);
+    }
+
+    MPI_Allgatherv(
+      MPI_IN_PLACE, 0, MPI_BYTE, buffer,
+      nodeByteCounts.data(),
+      nodeByteOffsets.data(),
+      MPI_BYTE, this->leaderComm);
+  }
+
+  this->NodeBarrier();
 }
 
 
 unsigned Universe::GetDomainStart(void) {
-  return this->rankBodyOffsets[MyRank()];
+  return this->rankBodyOffsets[MyRank(this->comm)];
 }
 
 unsigned Universe::GetDomainEnd(void) {
-  return this->rankBodyOffsets[MyRank()] + this->rankBodyCounts[MyRank()];
+  int rank = MyRank(this->comm);
+  return this->rankBodyOffsets[rank] + this->rankBodyCounts[rank];
 }
 
 unsigned Universe::GetDomainSize(void) {
-  return this->rankBodyCounts[MyRank()];
+  return this->rankBodyCounts[MyRank(this->comm)];
+}
+
+unsigned Universe::GetDomainSourceEnd(void) {
+  int rank = MyRank(this->comm);
+  return this->rankBodyOffsets[rank] + this->rankSourceCounts[rank];
 }
 
 
 void Universe::SetGravitationalConstant(float const G) {
   if(G != this->G) {
     this->G = G;
+    this->forcesPrimed = false;
     this->clKernel.setArg(8, G);
+    this->clKernelIntegrate.setArg(7, G);
   }
 }
 
@@ -221,25 +781,33 @@ void Universe::SetTimestepSize(float const dt) {
   if(dt != this->dt) {
     this->dt = dt;
     this->clKernel.setArg(7, dt);
+    this->clKernelIntegrate.setArg(6, dt);
   }
 }
 
 
+float Universe::GetTimestepSize(void) {
+  return this->dt;
+}
+
+
 void Universe::SetSofteningFactor(float const e) {
   if(e != this->e) {
     this->e = e;
+    this->forcesPrimed = false;
     float e2 = e * e;
     this->clKernel.setArg(9, e2);
+    this->clKernelAccumulate.setArg(3, e2);
+
+    ShortRangeParams p(this->config.cutoff, e, this->config.screeningLength);
+    this->clKernelCells.setArg(7, p.e2);
+    this->clKernelCells.setArg(9, p.shift);
   }
 }
 
 
-// Opencl iteration kernel
-// returns the execution time of the iteration
-double Universe::IterateCL(void) {
-  double tStart = MPI_Wtime();
-
-  // Copy inputs to opencl buffers
+// Copy integrator terms to opencl input buffers
+void Universe::WriteInputBuffers(void) {
   this->clCommandQueue.enqueueWriteBuffer(
     this->clBuf_m, CL_TRUE, 0, this->bodyCount * sizeof(float), this->m);
   this->clCommandQueue.enqueueWriteBuffer(
@@ -248,14 +816,120 @@ double Universe::IterateCL(void) {
     this->clBuf_v, CL_TRUE, 0, this->bodyCount * sizeof(Vec3), this->v);
   this->clCommandQueue.enqueueWriteBuffer(
     this->clBuf_a, CL_TRUE, 0, this->bodyCount * sizeof(Vec3), this->a);
+}
 
-  // Run the kernel
-  cl::NDRange globalWork = this->GetDomainSize();
-  cl::NDRange localWork = 2;
-  this->clCommandQueue.enqueueNDRangeKernel(
-    this->clKernel, cl::NullRange, globalWork, localWork);
 
-  // Get outputs from kernel
+// Opencl iteration kernel
+// returns the execution time of the iteration
+double Universe::IterateCL(void) {
+  double tStart = MPI_Wtime();
+
+  // The fused kernel treats every body as a source
+  if(this->FusedCL()) {
+
+    // Copy inputs to opencl buffers
+    this->WriteInputBuffers();
+
+    // Run the kernel
+    this->EnqueueKernel(this->clKernel);
+
+    // Get outputs from kernel
+    this->ReadOutputBuffers();
+
+    // Finish the kernel's per group acceleration maxima
+    std::vector<float> groupMax2(this->GroupCount());
+    this->clCommandQueue.enqueueReadBuffer(
+      this->clBuf_aMax2, CL_TRUE, 0,
+      groupMax2.size() * sizeof(float), groupMax2.data());
+    this->accelerationMax2 = 0;
+    this->jerkMax2 = 0;
+    for(unsigned k = 0; k < groupMax2.size(); k++) {
+      this->accelerationMax2 = std::max(this->accelerationMax2, groupMax2[k]);
+    }
+
+    // Swap references to next/previous buffers
+    this->SwapBuffers();
+    this->Synchronize();
+  } else {
+
+    // A kernel launch per force evaluation
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_m, CL_TRUE, 0, this->bodyCount * sizeof(float), this->m);
+    auto forces = [this](Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut) {
+      if(this->config.cutoff > 0) this->EvaluateShortRange(rEval, aOut, true);
+      else this->EvaluateForcesCL(rEval, vEval, aOut, jOut);
+    };
+    this->Step(forces);
+  }
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+// Fused kernel steps queued back to back with nothing read in between,
+// the host only waits every residentSteps steps so it can't run too far
+// ahead. returns the time taken to queue the step, or to wait for the last
+// few on the steps which wait.
+double Universe::IterateResident(void) {
+  double tStart = MPI_Wtime();
+
+  if(this->deviceStale) {
+    this->WriteInputBuffers();
+    this->deviceStale = false;
+  }
+
+  this->EnqueueKernel(this->clKernel);
+  this->SwapBuffersCL();
+  this->hostStale = true;
+
+  if(++this->residentPending >= this->config.residentSteps) {
+    this->clCommandQueue.finish();
+    this->residentPending = 0;
+  } else {
+    this->clCommandQueue.flush();
+  }
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+// Steps can stay on the device when one rank does all the work & nothing
+// but the fused kernel touches the state between steps
+bool Universe::Resident(engine_t const engine) {
+  return
+    this->config.residentSteps > 0 &&
+    engine == ENGINE_OPENCL &&
+    RankCount(this->comm) == 1 &&
+    this->config.integrator == INTEGRATOR_LEAPFROG &&
+    !this->config.overlapExchange &&
+    this->config.cutoff <= 0 &&
+    this->config.collisionRadius <= 0 &&
+    !this->config.reorderInterval &&
+    !this->timestep.Enabled() &&
+    !this->tracerCount;
+}
+
+
+// Read the state back after resident steps, waits for the queue to drain
+void Universe::FetchResident(void) {
+  if(!this->hostStale) return;
+
+  size_t bytes = this->bodyCount * sizeof(Vec3);
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_r, CL_FALSE, 0, bytes, this->r);
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_v, CL_FALSE, 0, bytes, this->v);
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_a, CL_TRUE, 0, bytes, this->a);
+  this->residentPending = 0;
+  this->hostStale = false;
+}
+
+
+// Copy this rank's domain back from the opencl output buffers
+void Universe::ReadOutputBuffers(void) {
   this->clCommandQueue.enqueueReadBuffer(
     this->clBuf_rNext, CL_TRUE, 0,
     this->GetDomainSize() * sizeof(Vec3),
@@ -268,13 +942,6 @@ double Universe::IterateCL(void) {
     this->clBuf_aNext, CL_TRUE, 0,
     this->GetDomainSize() * sizeof(Vec3),
     &this->aNext[this->GetDomainStart()]);
-
-  // Swap references to next/previous buffers
-  this->SwapBuffers();
-  this->Synchronize();
-
-  double tEnd = MPI_Wtime();
-  return tEnd - tStart;
 }
 
 
@@ -282,38 +949,156 @@ double Universe::IterateCL(void) {
 // returns the execution time of the iteration
 double Universe::Iterate(void) {
   double tStart = MPI_Wtime();
+
+  auto forces = [this](Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut) {
+    if(this->config.cutoff > 0) this->EvaluateShortRange(rEval, aOut, false);
+    else this->EvaluateForces(rEval, vEval, aOut, jOut);
+  };
+  this->Step(forces);
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+// Accumulate unscaled acceleration on this rank's domain due to the
+// domain itself, one-sided. Thread 0 keeps any position exchange moving.
+void Universe::AccumulateLocal(void) {
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainEnd = this->GetDomainEnd();
+  unsigned sourceEnd = this->GetDomainSourceEnd();
   float e2 = this->e * this->e;
 
-  // Iterate over all bodies
-  #pragma omp parallel for
-  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
-    this->aNext[i] = Vec3(0, 0, 0);
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = domainStart; i < domainEnd; i++) {
+    if(!omp_get_thread_num() && !(i % 16)) this->PollExchange();
+
+    Vec3 ai(0, 0, 0);
+    for(unsigned j = domainStart; j < sourceEnd; j++) {
+      if(this->r[i] != this->r[j]) {
+        Vec3 dr = this->r[j] - this->r[i];
+        float r2 = (dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z);
+        ai = ai + (dr * (this->m[j] / (sqrt(r2) * (r2 + e2))));
+      }
+    }
+    this->aNext[i] = ai;
+  }
+}
+
+
+// Accumulate unscaled acceleration on this rank's domain due to the domain
+// itself using newton's third law, each pair is evaluated once and applied
+// to both bodies. Reactions are collected in per-thread accumulators
+// (threads * domain sources) and merged afterwards.
+void Universe::AccumulateLocalSymmetric(void) {
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainEnd = this->GetDomainSourceEnd();
+  unsigned domainSize = domainEnd - domainStart;
+  unsigned tracerEnd = this->GetDomainEnd();
+  float e2 = this->e * this->e;
+  this->threadAccumulators.resize(omp_get_max_threads() * domainSize);
+
+  #pragma omp parallel
+  {
+    int threadCount = omp_get_num_threads();
+    Vec3* acc = &this->threadAccumulators[omp_get_thread_num() * domainSize];
+    for(unsigned k = 0; k < domainSize; k++) acc[k] = Vec3(0, 0, 0);
+
+    // Rows get shorter as i increases, so hand them out dynamically
+    #pragma omp for schedule(dynamic, 16)
+    for(unsigned i = domainStart; i < domainEnd; i++) {
+      if(!omp_get_thread_num()) this->PollExchange();
+
+      Vec3 ai(0, 0, 0);
+      for(unsigned j = i + 1; j < domainEnd; j++) {
+        if(this->r[i] != this->r[j]) {
+          Vec3 dr = this->r[j] - this->r[i];
+          float r2 = (dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z);
+          Vec3 f = dr / (sqrt(r2) * (r2 + e2));
+          ai = ai + (f * this->m[j]);
+          acc[j - domainStart] = acc[j - domainStart] - (f * this->m[i]);
+        }
+      }
+      acc[i - domainStart] = acc[i - domainStart] + ai;
+    }
+
+    // Merge accumulators
+    #pragma omp for schedule(static)
+    for(unsigned i = domainStart; i < domainEnd; i++) {
+      Vec3 ai(0, 0, 0);
+      for(int t = 0; t < threadCount; t++) {
+        ai = ai + this->threadAccumulators[(t * domainSize) + i - domainStart];
+      }
+      this->aNext[i] = ai;
+    }
+
+    // Tracers don't pull back, so they're one sided
+    #pragma omp for schedule(static)
+    for(unsigned i = domainEnd; i < tracerEnd; i++) {
+      Vec3 ai(0, 0, 0);
+      for(unsigned j = domainStart; j < domainEnd; j++) {
+        if(this->r[i] != this->r[j]) {
+          Vec3 dr = this->r[j] - this->r[i];
+          float r2 = (dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z);
+          ai = ai + (dr * (this->m[j] / (sqrt(r2) * (r2 + e2))));
+        }
+      }
+      this->aNext[i] = ai;
+    }
+  }
+}
+
+
+// Add the contribution of another rank's sources to aNext
+void Universe::AccumulateSlice(int const rank) {
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainEnd = this->GetDomainEnd();
+  unsigned sliceStart = this->rankBodyOffsets[rank];
+  unsigned sliceEnd = sliceStart + this->rankSourceCounts[rank];
+  float e2 = this->e * this->e;
 
-    // Compute acceleration due to other bodies
-    for(unsigned j = 0; j < this->bodyCount; j++) {
-      if((i != j) && (this->r[i] != this->r[j])) {
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = domainStart; i < domainEnd; i++) {
+    Vec3 ai = this->aNext[i];
+    for(unsigned j = sliceStart; j < sliceEnd; j++) {
+      if(this->r[i] != this->r[j]) {
         Vec3 dr = this->r[j] - this->r[i];
         float r2 = (dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z);
-        float r = sqrt(r2);
-        float aScalar = this->m[j] / (r2 + e2);
-        this->aNext[i].x += aScalar * dr.x / r;
-        this->aNext[i].y += aScalar * dr.y / r;
-        this->aNext[i].z += aScalar * dr.z / r;
+        ai = ai + (dr * (this->m[j] / (sqrt(r2) * (r2 + e2))));
       }
     }
+    this->aNext[i] = ai;
+  }
+}
+
+
+// Scale accumulated accelerations & integrate this rank's domain
+void Universe::IntegrateDomain(void) {
+  StepState s = this->State();
+  float aMax2 = 0;
+
+  #pragma omp parallel for schedule(static) reduction(max:aMax2)
+  for(unsigned i = s.start; i < s.end; i++) {
     this->aNext[i] = this->aNext[i] * this->G;
+    aMax2 = std::max(aMax2, Dot(this->aNext[i], this->aNext[i]));
+    Leapfrog::Integrate(s, i);
+  }
+
+  this->accelerationMax2 = aMax2;
+  this->jerkMax2 = 0;
+}
+
 
-    // Compute next position
-    this->rNext[i] =
-      this->r[i] +
-      (this->v[i] * this->dt) +
-      ((this->a[i] * (this->dt * this->dt)) / 2);
+// Iterate using newton's third law within this rank's domain
+// returns the execution time of the iteration
+double Universe::IterateSymmetric(void) {
+  double tStart = MPI_Wtime();
 
-    // Compute next velocity
-    this->vNext[i] =
-      this->v[i] +
-      (((this->a[i] + this->aNext[i]) / 2) * this->dt);
+  this->AccumulateLocalSymmetric();
+  for(int k = 0; k < RankCount(this->comm); k++) {
+    if(k != MyRank(this->comm)) this->AccumulateSlice(k);
   }
+  this->IntegrateDomain();
 
   // Swap references to next/previous buffers
   this->SwapBuffers();
@@ -324,24 +1109,1262 @@ double Universe::Iterate(void) {
 }
 
 
-// Get a vector of body data from the universe
-std::vector<Body> Universe::GetBodyData(void) {
-  std::vector<Body> bodyData(this->bodyCount);
-  for(unsigned i = 0; i < this->bodyCount; i++) {
-    bodyData[i].m = this->m[i];
-    bodyData[i].r = this->r[i];
+//====[INTEGRATORS]=========================================================//
+
+// Integrator term buffers for the current step
+StepState Universe::State(void) {
+  StepState s;
+  s.r = this->r;
+  s.v = this->v;
+  s.a = this->a;
+  s.j = this->j;
+  s.rNext = this->rNext;
+  s.vNext = this->vNext;
+  s.aNext = this->aNext;
+  s.jNext = this->jNext;
+  s.start = this->GetDomainStart();
+  s.end = this->GetDomainEnd();
+  s.dt = this->dt;
+  return s;
+}
+
+
+// Advance one step with the configured integrator & share the results
+template<typename Forces>
+void Universe::Step(Forces& forces) {
+  auto counted = [&](Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut) {
+    this->forceEvaluations++;
+    forces(rEval, vEval, aOut, jOut);
+  };
+  switch(this->config.integrator) {
+    case INTEGRATOR_HERMITE: this->StepWith<Hermite>(counted); break;
+    case INTEGRATOR_YOSHIDA: this->StepWith<Yoshida>(counted); break;
+    default: this->StepWith<Leapfrog>(counted); break;
+  }
+
+  // Swap references to next/previous buffers, short range forces only
+  // need the halos each evaluation exchanges
+  this->SwapBuffers();
+  if(this->config.cutoff <= 0) this->Synchronize();
+}
+
+
+// Schemes which reuse the start of step forces need them evaluated at the
+// current state first, i.e. on the first step & whenever bodies or force
+// parameters have changed underneath them
+template<typename Integrator, typename Forces>
+void Universe::StepWith(Forces& forces) {
+  if(Integrator::primed && !this->forcesPrimed) {
+    forces(this->r, this->v, this->a, Integrator::jerk ? this->j : nullptr);
+  }
+  this->forcesPrimed = true;
+
+  Integrator::Step(this->State(), forces);
+}
+
+
+// Make the domain parts of evaluation buffers visible to every rank, the
+// current positions & velocities are always in sync already
+void Universe::ShareEvaluationPoints(Vec3* rEval, Vec3* vEval) {
+  if(rEval != this->r) this->AllgatherDomain(rEval);
+  if(vEval && vEval != this->v) this->AllgatherDomain(vEval);
+}
+
+
+// Force functor for the cpu engine
+void Universe::EvaluateForces(
+  Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut) {
+
+  this->ShareEvaluationPoints(rEval, vEval);
+  if(jOut) this->AccumulateForces<true>(rEval, vEval, aOut, jOut);
+  else this->AccumulateForces<false>(rEval, vEval, aOut, jOut);
+
+  // Integrators overwrite the evaluation points next, shared buffers must
+  // not change while the rest of the node is still reading them
+  this->NodeBarrier();
+}
+
+
+// Acceleration & optionally jerk on this rank's domain due to all sources,
+// scaled by G. Schedule matches first touch placement.
+template<bool jerk>
+void Universe::AccumulateForces(
+  Vec3 const* rEval, Vec3 const* vEval, Vec3* aOut, Vec3* jOut) {
+
+  float e2 = this->e * this->e;
+  float aMax2 = 0;
+  float jMax2 = 0;
+  std::vector<unsigned> const& ranges = this->sourceRanges;
+
+  #pragma omp parallel for schedule(static) reduction(max:aMax2, jMax2)
+  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
+    Vec3 ai(0, 0, 0);
+    Vec3 ji(0, 0, 0);
+
+    for(unsigned n = 0; n < ranges.size(); n += 2) {
+      for(unsigned k = ranges[n]; k < ranges[n + 1]; k++) {
+        if((i != k) && (rEval[i] != rEval[k])) {
+          Vec3 dr = rEval[k] - rEval[i];
+          float r2 = Dot(dr, dr);
+          float q = this->m[k] / (sqrt(r2) * (r2 + e2));
+          ai = ai + (dr * q);
+
+          // Time derivative of the above along the relative velocity
+          if(jerk) {
+            Vec3 dv = vEval[k] - vEval[i];
+            float s = Dot(dr, dv) * ((3 * r2) + e2) * q / (r2 * (r2 + e2));
+            ji = ji + (dv * q) - (dr * s);
+          }
+        }
+      }
+    }
+
+    aOut[i] = ai * this->G;
+    aMax2 = std::max(aMax2, Dot(aOut[i], aOut[i]));
+    if(jerk) {
+      jOut[i] = ji * this->G;
+      jMax2 = std::max(jMax2, Dot(jOut[i], jOut[i]));
+    }
+  }
+
+  this->accelerationMax2 = aMax2;
+  this->jerkMax2 = jMax2;
+}
+
+
+// Force functor for the opencl engine, one accumulate launch per range of
+// sources. The kernel computes the jerk when built for hermite.
+void Universe::EvaluateForcesCL(
+  Vec3* rEval, Vec3* vEval, Vec3* aOut, Vec3* jOut) {
+
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainSize = this->GetDomainSize();
+  this->ShareEvaluationPoints(rEval, vEval);
+
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_r, CL_TRUE, 0, this->bodyCount * sizeof(Vec3), rEval);
+  if(vEval) {
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_v, CL_TRUE, 0, this->bodyCount * sizeof(Vec3), vEval);
+  }
+
+  // Uploads are blocking, the node may overwrite shared evaluation points
+  this->NodeBarrier();
+
+  for(unsigned n = 0; n < this->sourceRanges.size(); n += 2) {
+    this->EnqueueAccumulate(
+      this->sourceRanges[n], this->sourceRanges[n + 1] - this->sourceRanges[n],
+      n == 0);
+  }
+
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_aNext, CL_TRUE, 0,
+    domainSize * sizeof(Vec3), &aOut[domainStart]);
+  if(jOut) {
+    this->clCommandQueue.enqueueReadBuffer(
+      this->clBuf_jNext, CL_TRUE, 0,
+      domainSize * sizeof(Vec3), &jOut[domainStart]);
+  }
+
+  float aMax2 = 0;
+  float jMax2 = 0;
+
+  #pragma omp parallel for schedule(static) reduction(max:aMax2, jMax2)
+  for(unsigned i = domainStart; i < domainStart + domainSize; i++) {
+    aOut[i] = aOut[i] * this->G;
+    aMax2 = std::max(aMax2, Dot(aOut[i], aOut[i]));
+    if(jOut) {
+      jOut[i] = jOut[i] * this->G;
+      jMax2 = std::max(jMax2, Dot(jOut[i], jOut[i]));
+    }
+  }
+
+  this->accelerationMax2 = aMax2;
+  this->jerkMax2 = jMax2;
+}
+
+
+//====[SHORT RANGE]==========================================================//
+
+// Force functor for the short range mode. Each evaluation exchanges halos
+// in place of sharing every position, then walks the neighbouring cells.
+void Universe::EvaluateShortRange(
+  Vec3* rEval, Vec3* aOut, bool const useCL) {
+
+  this->ExchangeHalo(rEval);
+  SpatialHash cells(this->config.cutoff);
+  this->BuildCells(rEval, cells);
+
+  if(useCL) {
+    this->AccumulateShortRangeCL(cells, rEval, aOut);
+  } else {
+    switch(this->config.forceLaw) {
+      case FORCE_SHIFTED:
+        this->AccumulateShortRange<FORCE_SHIFTED>(cells, rEval, aOut);
+        break;
+      case FORCE_SCREENED:
+        this->AccumulateShortRange<FORCE_SCREENED>(cells, rEval, aOut);
+        break;
+      default:
+        this->AccumulateShortRange<FORCE_TRUNCATED>(cells, rEval, aOut);
+        break;
+    }
+  }
+
+  float aMax2 = 0;
+
+  #pragma omp parallel for schedule(static) reduction(max:aMax2)
+  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
+    aOut[i] = aOut[i] * this->G;
+    aMax2 = std::max(aMax2, Dot(aOut[i], aOut[i]));
+  }
+
+  this->accelerationMax2 = aMax2;
+  this->jerkMax2 = 0;
+}
+
+
+// Send every other rank this rank's sources within the cutoff of its
+// domain's bounding box. Domains are compact after sorting, so that's a
+// thin shell of each. Received positions are written straight into rEval.
+void Universe::ExchangeHalo(Vec3* rEval) {
+  this->haloBodies.clear();
+  int ranks = RankCount(this->comm);
+  int rank = MyRank(this->comm);
+  if(ranks == 1) return;
+
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainEnd = this->GetDomainEnd();
+  unsigned sourceEnd = this->GetDomainSourceEnd();
+
+  // Bounding box of the bodies this rank evaluates, inverted when empty
+  float inf = std::numeric_limits<float>::infinity();
+  float xMin = inf, yMin = inf, zMin = inf;
+  float xMax = -inf, yMax = -inf, zMax = -inf;
+
+  #pragma omp parallel for schedule(static) \
+    reduction(min:xMin, yMin, zMin) reduction(max:xMax, yMax, zMax)
+  for(unsigned i = domainStart; i < domainEnd; i++) {
+    xMin = std::min(xMin, rEval[i].x);
+    yMin = std::min(yMin, rEval[i].y);
+    zMin = std::min(zMin, rEval[i].z);
+    xMax = std::max(xMax, rEval[i].x);
+    yMax = std::max(yMax, rEval[i].y);
+    zMax = std::max(zMax, rEval[i].z);
+  }
+
+  float box[6] = {xMin, yMin, zMin, xMax, yMax, zMax};
+  std::vector<float> boxes(6 * ranks);
+  MPI_Allgather(box, 6, MPI_FLOAT, boxes.data(), 6, MPI_FLOAT, this->comm);
+
+  // Sources within reach of each other rank's box
+  float cutoff2 = this->config.cutoff * this->config.cutoff;
+  std::vector<std::vector<unsigned>> sends(ranks);
+
+  #pragma omp parallel for schedule(dynamic)
+  for(int k = 0; k < ranks; k++) {
+    if(k == rank) continue;
+    float const* b = &boxes[6 * k];
+    for(unsigned i = domainStart; i < sourceEnd; i++) {
+      Vec3 p = rEval[i];
+      float dx = std::max(std::max(b[0] - p.x, p.x - b[3]), 0.0f);
+      float dy = std::max(std::max(b[1] - p.y, p.y - b[4]), 0.0f);
+      float dz = std::max(std::max(b[2] - p.z, p.z - b[5]), 0.0f);
+      if((dx * dx) + (dy * dy) + (dz * dz) < cutoff2) sends[k].push_back(i);
+    }
+  }
+
+  // Indices first, then positions in the same layout
+  std::vector<int> sendCounts(ranks);
+  std::vector<int> sendOffsets(ranks);
+  std::vector<int> recvCounts(ranks);
+  std::vector<int> recvOffsets(ranks);
+  std::vector<unsigned> sendIndices;
+  for(int k = 0; k < ranks; k++) {
+    sendOffsets[k] = sendIndices.size();
+    sendCounts[k] = sends[k].size();
+    sendIndices.insert(sendIndices.end(), sends[k].begin(), sends[k].end());
+  }
+  MPI_Alltoall(
+    sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT,
+    this->comm);
+
+  int total = 0;
+  for(int k = 0; k < ranks; k++) {
+    recvOffsets[k] = total;
+    total += recvCounts[k];
+  }
+
+  this->haloBodies.resize(total);
+  MPI_Alltoallv(
+    sendIndices.data(), sendCounts.data(), sendOffsets.data(), MPI_UNSIGNED,
+    this->haloBodies.data(), recvCounts.data(), recvOffsets.data(),
+    MPI_UNSIGNED, this->comm);
+
+  std::vector<Vec3> sendPositions(sendIndices.size());
+  std::vector<Vec3> recvPositions(total);
+  for(unsigned n = 0; n < sendIndices.size(); n++) {
+    sendPositions[n] = rEval[sendIndices[n]];
+  }
+  for(int k = 0; k < ranks; k++) {
+    sendCounts[k] *= sizeof(Vec3);
+    sendOffsets[k] *= sizeof(Vec3);
+    recvCounts[k] *= sizeof(Vec3);
+    recvOffsets[k] *= sizeof(Vec3);
+  }
+  MPI_Alltoallv(
+    sendPositions.data(), sendCounts.data(), sendOffsets.data(), MPI_BYTE,
+    recvPositions.data(), recvCounts.data(), recvOffsets.data(), MPI_BYTE,
+    this->comm);
+
+  #pragma omp parallel for schedule(static)
+  for(int n = 0; n < total; n++) {
+    rEval[this->haloBodies[n]] = recvPositions[n];
+  }
+}
+
+
+// Bin this rank's sources & the halo into cells as wide as the cutoff,
+// stored in bucket order so each bucket's sources are contiguous
+void Universe::BuildCells(Vec3 const* rEval, SpatialHash& cells) {
+  unsigned domainStart = this->GetDomainStart();
+  unsigned local = this->GetDomainSourceEnd() - domainStart;
+  unsigned count = local + this->haloBodies.size();
+
+  std::vector<unsigned> sources(count);
+  std::vector<Vec3> positions(count);
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned n = 0; n < count; n++) {
+    sources[n] = n < local ? domainStart + n : this->haloBodies[n - local];
+    positions[n] = rEval[sources[n]];
+  }
+
+  cells.Build(positions.data(), count);
+  std::vector<unsigned> const& order = cells.Order();
+  this->cellMasses.resize(count);
+  this->cellPositions.resize(count);
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned n = 0; n < count; n++) {
+    this->cellMasses[n] = this->m[sources[order[n]]];
+    this->cellPositions[n] = positions[order[n]];
+  }
+}
+
+
+// Unscaled acceleration on this rank's domain due to the sources in the
+// cells around each body. Schedule matches first touch placement.
+template<force_law_t law>
+void Universe::AccumulateShortRange(
+  SpatialHash const& cells, Vec3 const* rEval, Vec3* aOut) {
+
+  ShortRangeParams p(
+    this->config.cutoff, this->e, this->config.screeningLength);
+  float const* cm = this->cellMasses.data();
+  Vec3 const* cr = this->cellPositions.data();
+
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
+    Vec3 ri = rEval[i];
+    Vec3 ai(0, 0, 0);
+
+    cells.ForEachNeighbourRange(ri, [&](unsigned start, unsigned end) {
+      for(unsigned n = start; n < end; n++) {
+        Vec3 dr = cr[n] - ri;
+        float r2 = Dot(dr, dr);
+        if(r2 > 0 && r2 < p.cutoff2) {
+          ai = ai + (dr * (cm[n] * PairScale<law>(r2, p)));
+        }
+      }
+    });
+
+    aOut[i] = ai;
+  }
+}
+
+
+// Upload the cell lists & this rank's evaluation points, one launch covers
+// the whole domain
+void Universe::AccumulateShortRangeCL(
+  SpatialHash const& cells, Vec3 const* rEval, Vec3* aOut) {
+
+  unsigned domainStart = this->GetDomainStart();
+  unsigned domainSize = this->GetDomainSize();
+  if(!domainSize) return;
+
+  std::vector<unsigned> const& starts = cells.BucketStarts();
+  unsigned count = this->cellMasses.size();
+  this->ReserveCellBuffersCL(count, starts.size());
+
+  if(count) {
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_cellM, CL_FALSE, 0, count * sizeof(float),
+      this->cellMasses.data());
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_cellR, CL_FALSE, 0, count * sizeof(Vec3),
+      this->cellPositions.data());
+  }
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_cellStart, CL_FALSE, 0, starts.size() * sizeof(unsigned),
+    starts.data());
+  this->clCommandQueue.enqueueWriteBuffer(
+    this->clBuf_r, CL_FALSE, domainStart * sizeof(Vec3),
+    domainSize * sizeof(Vec3), &rEval[domainStart]);
+
+  this->clKernelCells.setArg(2, this->clBuf_cellM);
+  this->clKernelCells.setArg(3, this->clBuf_cellR);
+  this->clKernelCells.setArg(4, this->clBuf_cellStart);
+  this->clKernelCells.setArg(5, cells.TableMask());
+  this->clKernelCells.setArg(6, cells.CellInverse());
+  this->clCommandQueue.enqueueNDRangeKernel(
+    this->clKernelCells, cl::NullRange, cl::NDRange(domainSize));
+
+  this->clCommandQueue.enqueueReadBuffer(
+    this->clBuf_aNext, CL_TRUE, 0,
+    domainSize * sizeof(Vec3), &aOut[domainStart]);
+}
+
+
+// Cell lists change size every step, grow their buffers geometrically
+void Universe::ReserveCellBuffersCL(
+  unsigned const count, unsigned const buckets) {
+
+  if(!this->cellCapacity || count > this->cellCapacity) {
+    this->cellCapacity =
+      std::max(std::max(count, 2 * this->cellCapacity), 1u);
+    this->clBuf_cellM = cl::Buffer(
+      this->clContext, CL_MEM_READ_ONLY, this->cellCapacity * sizeof(float));
+    this->clBuf_cellR = cl::Buffer(
+      this->clContext, CL_MEM_READ_ONLY, this->cellCapacity * sizeof(Vec3));
+  }
+
+  if(buckets > this->cellTableCapacity) {
+    this->cellTableCapacity = std::max(buckets, 2 * this->cellTableCapacity);
+    this->clBuf_cellStart = cl::Buffer(
+      this->clContext, CL_MEM_READ_ONLY,
+      this->cellTableCapacity * sizeof(unsigned));
+  }
+}
+
+
+//====[PARTICLE MESH]========================================================//
+
+// Iterate with forces from the periodic particle-mesh solver, softening is
+// provided by the mesh spacing so e is unused here
+double Universe::IteratePM(void) {
+  double tStart = MPI_Wtime();
+
+  if(!this->mesh) {
+    this->mesh.reset(new ParticleMesh(
+      this->config.meshSize, this->config.boxSize, this->comm));
+  }
+
+  this->mesh->ComputeAccelerations(
+    this->m, this->r, this->GetDomainStart(), this->GetDomainEnd(),
+    this->aNext);
+  this->IntegrateDomain();
+
+  // Bodies leaving the box re-enter on the opposite side
+  #pragma omp parallel for schedule(static)
+  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
+    this->rNext[i] = this->mesh->Wrap(this->rNext[i]);
+  }
+
+  // Swap references to next/previous buffers
+  this->SwapBuffers();
+  this->Synchronize();
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+//====[OVERLAPPED EXCHANGE]==================================================//
+
+// Post the exchange of this step's source positions, one broadcast per
+// slice so that each can be consumed as soon as it lands
+void Universe::BeginExchange(void) {
+  if(RankCount(this->comm) == 1) return;
+
+  this->exchangeRequests.resize(RankCount(this->comm));
+  for(int k = 0; k < RankCount(this->comm); k++) {
+    MPI_Ibcast(
+      &this->r[this->rankBodyOffsets[k]],
+      this->rankSourceCounts[k] * sizeof(Vec3),
+      MPI_BYTE, k, this->comm, &this->exchangeRequests[k]);
+  }
+}
+
+
+// Test outstanding exchanges, recording remote slices which have landed
+// Called from the master thread only while compute is under way
+void Universe::PollExchange(void) {
+  if(this->exchangeRequests.empty()) return;
+
+  int index, flag;
+  do {
+    MPI_Testany(
+      this->exchangeRequests.size(), this->exchangeRequests.data(),
+      &index, &flag, MPI_STATUS_IGNORE);
+    if(flag && index != MPI_UNDEFINED && index != MyRank(this->comm)) {
+      this->landedSlices.push_back(index);
+    }
+  } while(flag && index != MPI_UNDEFINED);
+}
+
+
+// Returns the next remote slice to fold in, waiting for it if necessary,
+// or -1 once all slices for this step are done
+int Universe::NextLandedSlice(void) {
+  while(this->landedSlices.empty()) {
+    if(this->exchangeRequests.empty()) return -1;
+
+    int index;
+    MPI_Waitany(
+      this->exchangeRequests.size(), this->exchangeRequests.data(),
+      &index, MPI_STATUS_IGNORE);
+    if(index == MPI_UNDEFINED) {
+      this->exchangeRequests.clear();
+    } else if(index != MyRank(this->comm)) {
+      this->landedSlices.push_back(index);
+    }
+  }
+
+  int slice = this->landedSlices.back();
+  this->landedSlices.pop_back();
+  return slice;
+}
+
+
+// Wait for the exchange to complete so every position is current
+// Landed slices are kept so the next step still folds them in
+void Universe::FinishExchange(void) {
+  if(this->exchangeRequests.empty()) return;
+
+  for(unsigned k = 0; k < this->exchangeRequests.size(); k++) {
+    if(this->exchangeRequests[k] == MPI_REQUEST_NULL) continue;
+    MPI_Wait(&this->exchangeRequests[k], MPI_STATUS_IGNORE);
+    if((int)k != MyRank(this->comm)) this->landedSlices.push_back(k);
+  }
+  this->exchangeRequests.clear();
+}
+
+
+// Iterate with remote positions arriving in the background. Interactions
+// within this rank's domain are computed first, remote slices are added as
+// they land and the integrator update waits until everything is in.
+// returns the execution time of the iteration
+double Universe::IterateOverlapped(engine_t const engine) {
+  double tStart = MPI_Wtime();
+
+  if(engine == ENGINE_OPENCL) {
+    unsigned domainStart = this->GetDomainStart();
+    unsigned domainSize = this->GetDomainSize();
+
+    // Local inputs, the kernel runs while we wait on the network
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_m, CL_FALSE, 0, this->bodyCount * sizeof(float), this->m);
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_r, CL_FALSE, domainStart * sizeof(Vec3),
+      domainSize * sizeof(Vec3), &this->r[domainStart]);
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_v, CL_FALSE, domainStart * sizeof(Vec3),
+      domainSize * sizeof(Vec3), &this->v[domainStart]);
+    this->clCommandQueue.enqueueWriteBuffer(
+      this->clBuf_a, CL_FALSE, domainStart * sizeof(Vec3),
+      domainSize * sizeof(Vec3), &this->a[domainStart]);
+    this->EnqueueAccumulate(
+      domainStart, this->GetDomainSourceEnd() - domainStart, true);
+    this->clCommandQueue.flush();
+
+    // Remote slices, uploaded & accumulated in arrival order
+    int k;
+    while((k = this->NextLandedSlice()) >= 0) {
+      this->clCommandQueue.enqueueWriteBuffer(
+        this->clBuf_r, CL_FALSE, this->rankBodyOffsets[k] * sizeof(Vec3),
+        this->rankSourceCounts[k] * sizeof(Vec3),
+        &this->r[this->rankBodyOffsets[k]]);
+      this->EnqueueAccumulate(
+        this->rankBodyOffsets[k], this->rankSourceCounts[k], false);
+      this->clCommandQueue.flush();
+    }
+
+    this->clCommandQueue.enqueueNDRangeKernel(
+      this->clKernelIntegrate, cl::NullRange, cl::NDRange(domainSize));
+    this->ReadOutputBuffers();
+    this->RecordDomainMax();
+  } else {
+    if(engine == ENGINE_CPU_SYMMETRIC) this->AccumulateLocalSymmetric();
+    else this->AccumulateLocal();
+
+    int k;
+    while((k = this->NextLandedSlice()) >= 0) {
+      this->AccumulateSlice(k);
+    }
+    this->IntegrateDomain();
+  }
+
+  // Swap references to next/previous buffers & send out new positions
+  this->SwapBuffers();
+  this->BeginExchange();
+
+  double tEnd = MPI_Wtime();
+  return tEnd - tStart;
+}
+
+
+// Enqueue accumulation of a range of sources onto this domain
+void Universe::EnqueueAccumulate(
+  unsigned const sourceStart, unsigned const sourceCount,
+  bool const overwrite) {
+
+  int start = sourceStart;
+  int count = sourceCount;
+  int overwriteFlag = overwrite;
+  this->clKernelAccumulate.setArg(6, start);
+  this->clKernelAccumulate.setArg(7, count);
+  this->clKernelAccumulate.setArg(8, overwriteFlag);
+  this->EnqueueKernel(this->clKernelAccumulate);
+}
+
+
+//====[COLLISIONS]===========================================================//
+
+// Find pairs of sources closer than the collision radius, each rank checks
+// its own domain against a spatial hash of all bodies. A pair is reported
+// by the owner of its lower index, so the gathered list has no duplicates.
+// Tracers pass through everything.
+std::vector<unsigned> Universe::FindCollisions(void) {
+  float radius = this->config.collisionRadius;
+  float radius2 = radius * radius;
+
+  SpatialHash hash(radius);
+  hash.Build(this->r, this->bodyCount);
+  unsigned domainStart = this->GetDomainStart();
+  unsigned sourceEnd = this->GetDomainSourceEnd();
+
+  std::vector<unsigned> localPairs;
+  #pragma omp parallel
+  {
+    std::vector<unsigned> threadPairs;
+
+    #pragma omp for schedule(static) nowait
+    for(unsigned i = domainStart; i < sourceEnd; i++) {
+      Vec3 ri = this->r[i];
+      hash.ForEachNeighbour(ri, [&](unsigned const j) {
+        if(j <= i || this->m[j] == 0) return;
+        Vec3 dr = this->r[j] - ri;
+        if((dr.x * dr.x) + (dr.y * dr.y) + (dr.z * dr.z) < radius2) {
+          threadPairs.push_back(i);
+          threadPairs.push_back(j);
+        }
+      });
+    }
+
+    #pragma omp critical
+    localPairs.insert(localPairs.end(), threadPairs.begin(), threadPairs.end());
+  }
+
+  // Share pairs with every rank
+  int localCount = localPairs.size();
+  std::vector<int> counts(RankCount(this->comm));
+  std::vector<int> offsets(RankCount(this->comm));
+  MPI_Allgather(
+    &localCount, 1, MPI_INT, counts.data(), 1, MPI_INT, this->comm);
+
+  int total = 0;
+  for(int k = 0; k < RankCount(this->comm); k++) {
+    offsets[k] = total;
+    total += counts[k];
+  }
+
+  std::vector<unsigned> pairs(total);
+  if(total) {
+    MPI_Allgatherv(
+      localPairs.data(), localCount, MPI_UNSIGNED,
+      pairs.data(), counts.data(), offsets.data(), MPI_UNSIGNED,
+      this->comm);
+  }
+  return pairs;
+}
+
+
+// Merge colliding bodies into the oldest body of each connected group,
+// conserving mass & momentum, then compact the arrays and redistribute
+// work. Every rank applies the same merges to its full copy of the state,
+// or with shared buffers, every node leader to the node's copy.
+// returns the number of bodies removed
+unsigned Universe::MergeCollisions(void) {
+  this->FinishExchange();
+  if(this->config.cutoff > 0) this->Synchronize();
+  std::vector<unsigned> pairs = this->FindCollisions();
+  if(pairs.empty()) return 0;
+
+  // Overlapped stepping only keeps positions current
+  if(this->config.overlapExchange) this->Synchronize();
+
+  // Union-find, roots are always the oldest body in a group so the result
+  // doesn't depend on storage order
+  std::vector<unsigned> const& ids = this->bodyIds;
+  std::vector<unsigned> parent(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) parent[i] = i;
+  auto find = [&](unsigned i) {
+    while(parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+  };
+  for(unsigned p = 0; p < pairs.size(); p += 2) {
+    unsigned ri = find(pairs[p]);
+    unsigned rj = find(pairs[p + 1]);
+    if(ids[ri] < ids[rj]) parent[rj] = ri;
+    else if(ids[rj] < ids[ri]) parent[ri] = rj;
+  }
+
+  // Resolve every body's root, the surviving bodies are the roots
+  unsigned count = 0;
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    parent[i] = find(i);
+    if(parent[i] == i) count++;
+  }
+  if(this->NodeLeader()) this->MergeGroups(parent);
+  this->NodeBarrier();
+
+  // Survivors keep the id of their group's root
+  unsigned kept = 0;
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    if(parent[i] == i) this->bodyIds[kept++] = this->bodyIds[i];
+  }
+  this->bodyIds.resize(kept);
+
+  unsigned removed = this->bodyCount - count;
+  this->bodyCount = count;
+  this->sourceCount -= removed;
+  this->forcesPrimed = false;
+  this->timestep.Reset();
+  this->IndexBodies();
+
+  // Tracers stay with their rank, so each domain keeps what's left of it
+  if(this->tracerCount) {
+    int ranks = RankCount(this->comm);
+    std::vector<unsigned> sourceCounts(ranks, 0);
+    std::vector<unsigned> tracerCounts(ranks);
+    for(int k = 0; k < ranks; k++) {
+      unsigned start = this->rankBodyOffsets[k];
+      for(unsigned i = start; i < start + this->rankSourceCounts[k]; i++) {
+        if(parent[i] == i) sourceCounts[k]++;
+      }
+      tracerCounts[k] = this->rankBodyCounts[k] - this->rankSourceCounts[k];
+    }
+    this->AssignDomains(sourceCounts, tracerCounts);
+  } else {
+    this->DistributeWork();
+  }
+  this->SetKernelDomainArgs();
+  return removed;
+}
+
+
+// Combine each group into its root & compact the state arrays
+void Universe::MergeGroups(std::vector<unsigned> const& roots) {
+
+  // Accumulate mass weighted terms of each group onto its root
+  std::vector<float> mTotal(this->m, this->m + this->bodyCount);
+  std::vector<char> grouped(this->bodyCount, 0);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    unsigned root = roots[i];
+    if(root == i) continue;
+
+    if(!grouped[root]) {
+      grouped[root] = 1;
+      this->r[root] = this->r[root] * this->m[root];
+      this->v[root] = this->v[root] * this->m[root];
+      this->a[root] = this->a[root] * this->m[root];
+    }
+    mTotal[root] += this->m[i];
+    this->r[root] = this->r[root] + (this->r[i] * this->m[i]);
+    this->v[root] = this->v[root] + (this->v[i] * this->m[i]);
+    this->a[root] = this->a[root] + (this->a[i] * this->m[i]);
+  }
+
+  // Divide through to get centre of mass terms
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    if(!grouped[i] || mTotal[i] <= 0) continue;
+    this->r[i] = this->r[i] / mTotal[i];
+    this->v[i] = this->v[i] / mTotal[i];
+    this->a[i] = this->a[i] / mTotal[i];
+    this->m[i] = mTotal[i];
+  }
+
+  // Compact, dropping bodies which merged into another
+  unsigned count = 0;
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    if(roots[i] != i) continue;
+    this->m[count] = this->m[i];
+    this->r[count] = this->r[i];
+    this->v[count] = this->v[i];
+    this->a[count] = this->a[i];
+    count++;
+  }
+}
+
+
+//====[REORDERING]===========================================================//
+
+// Sort bodies along a morton curve so that bodies near each other in space
+// are near each other in memory. Every rank holds the same sources & so
+// computes the same order, nothing needs to be exchanged.
+void Universe::Reorder(void) {
+  this->FinishExchange();
+
+  // Overlapped stepping only keeps positions current, short range forces
+  // only keep positions near each domain current
+  if(this->config.overlapExchange || this->config.cutoff > 0) {
+    this->Synchronize();
+  }
+
+  // Tracers stay put, sources are sorted within each domain so that every
+  // rank keeps the same bodies & their tracers
+  std::vector<unsigned> order;
+  if(!this->tracerCount) {
+    order = SortOrder(
+      MortonKeys(this->r, this->bodyCount), _MPIGRAV_MORTON_KEY_BITS);
+  } else {
+    order.resize(this->bodyCount);
+    for(unsigned i = 0; i < this->bodyCount; i++) order[i] = i;
+    for(int k = 0; k < RankCount(this->comm); k++) {
+      unsigned start = this->rankBodyOffsets[k];
+      std::vector<unsigned> domainOrder = SortOrder(
+        MortonKeys(&this->r[start], this->rankSourceCounts[k]),
+        _MPIGRAV_MORTON_KEY_BITS);
+      for(unsigned i = 0; i < domainOrder.size(); i++) {
+        order[start + i] = start + domainOrder[i];
+      }
+    }
+  }
+
+  // Gather into the spare buffers & swap them in
+  this->NodeBarrier();
+  if(this->NodeLeader()) {
+    std::vector<float> mSorted(this->bodyCount);
+
+    #pragma omp parallel
+    {
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < this->bodyCount; i++) {
+        mSorted[i] = this->m[order[i]];
+        this->rNext[i] = this->r[order[i]];
+        this->vNext[i] = this->v[order[i]];
+        this->aNext[i] = this->a[order[i]];
+      }
+
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < this->bodyCount; i++) this->m[i] = mSorted[i];
+    }
+  }
+  this->NodeBarrier();
+  this->SwapBuffers();
+
+  std::vector<unsigned> ids(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    ids[i] = this->bodyIds[order[i]];
+  }
+  this->bodyIds.swap(ids);
+  this->IndexBodies();
+
+  // Jerks are only held for the domain they were evaluated on
+  this->forcesPrimed = false;
+}
+
+
+// Find where each surviving body is stored, in creation order
+void Universe::IndexBodies(void) {
+  std::vector<int> slots(this->createdCount, -1);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    slots[this->bodyIds[i]] = i;
+  }
+
+  this->bodyIndex.clear();
+  this->storageOrdered = true;
+  for(unsigned id = 0; id < this->createdCount; id++) {
+    if(slots[id] < 0) continue;
+    if((unsigned)slots[id] != this->bodyIndex.size()) {
+      this->storageOrdered = false;
+    }
+    this->bodyIndex.push_back(slots[id]);
+  }
+}
+
+
+//====[ADDING & REMOVING BODIES]=============================================//
+
+unsigned Universe::AddBody(Body const& body, Vec3 const velocity) {
+  this->addedBodies.push_back(body);
+  this->addedVelocities.push_back(velocity);
+  return this->createdCount + this->addedBodies.size() - 1;
+}
+
+
+void Universe::RemoveBody(unsigned const id) {
+  this->removedIds.push_back(id);
+}
+
+
+// Apply the queued changes to every rank's copy of the state. Survivors
+// stay in their domains & new bodies go to the domains with the fewest of
+// their kind, so existing work assignments only move, never change hands.
+// Buffers are only replaced once the bodies no longer fit.
+// returns whether anything changed
+bool Universe::ApplyChanges(void) {
+  if(this->addedBodies.empty() && this->removedIds.empty()) return false;
+  this->FinishExchange();
+  this->FetchResident();
+
+  // Ids which won't be stored, unknown & already merged ids are ignored
+  unsigned addedCount = this->addedBodies.size();
+  std::vector<char> removed(this->createdCount + addedCount, 0);
+  for(unsigned id : this->removedIds) {
+    if(id < removed.size()) removed[id] = 1;
+  }
+
+  // Hand out the new bodies, sources & tracers balanced separately
+  int ranks = RankCount(this->comm);
+  std::vector<std::vector<unsigned>> rankSources(ranks);
+  std::vector<std::vector<unsigned>> rankTracers(ranks);
+  std::vector<unsigned> sourceCounts(ranks, 0);
+  std::vector<unsigned> tracerCounts(ranks, 0);
+  for(int k = 0; k < ranks; k++) {
+    unsigned start = this->rankBodyOffsets[k];
+    unsigned sourceEnd = start + this->rankSourceCounts[k];
+    unsigned end = start + this->rankBodyCounts[k];
+    for(unsigned i = start; i < end; i++) {
+      if(removed[this->bodyIds[i]]) continue;
+      if(i < sourceEnd) sourceCounts[k]++;
+      else tracerCounts[k]++;
+    }
+  }
+  for(unsigned n = 0; n < addedCount; n++) {
+    if(removed[this->createdCount + n]) continue;
+    bool tracer = this->addedBodies[n].m == 0;
+    std::vector<unsigned>& counts = tracer ? tracerCounts : sourceCounts;
+    int k = std::min_element(counts.begin(), counts.end()) - counts.begin();
+    (tracer ? rankTracers : rankSources)[k].push_back(n);
+    counts[k]++;
+  }
+
+  // Storage order of the result, each entry is either an index into the
+  // current storage or bodyCount plus an index into the queue
+  unsigned oldCount = this->bodyCount;
+  std::vector<unsigned> order;
+  for(int k = 0; k < ranks; k++) {
+    unsigned start = this->rankBodyOffsets[k];
+    unsigned sourceEnd = start + this->rankSourceCounts[k];
+    unsigned end = start + this->rankBodyCounts[k];
+    for(unsigned i = start; i < sourceEnd; i++) {
+      if(!removed[this->bodyIds[i]]) order.push_back(i);
+    }
+    for(unsigned n : rankSources[k]) order.push_back(oldCount + n);
+    for(unsigned i = sourceEnd; i < end; i++) {
+      if(!removed[this->bodyIds[i]]) order.push_back(i);
+    }
+    for(unsigned n : rankTracers[k]) order.push_back(oldCount + n);
+  }
+
+  unsigned count = order.size();
+  this->bodyCount = count;
+  this->sourceCount = 0;
+  for(int k = 0; k < ranks; k++) this->sourceCount += sourceCounts[k];
+  this->tracerCount = count - this->sourceCount;
+  this->AssignDomains(sourceCounts, tracerCounts);
+
+  // Grow geometrically, the old buffers are read from until the gather is
+  // done. Otherwise gather into the spare buffers & swap them in.
+  float* m = this->m;
+  Vec3* r = this->r;
+  Vec3* v = this->v;
+  Vec3* a = this->a;
+  Arena oldStorage;
+  MPI_Win oldWindow = this->nodeWindow;
+  bool grow = count > this->capacity;
+  this->NodeBarrier();
+  if(grow) {
+    this->capacity = std::max(count, 2 * this->capacity);
+    oldStorage = std::move(this->storage);
+    this->AllocateStorage();
+  }
+  Vec3* rOut = grow ? this->r : this->rNext;
+  Vec3* vOut = grow ? this->v : this->vNext;
+  Vec3* aOut = grow ? this->a : this->aNext;
+
+  if(this->NodeLeader()) {
+    std::vector<float> mOut(count);
+
+    #pragma omp parallel
+    {
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < count; i++) {
+        unsigned from = order[i];
+        if(from < oldCount) {
+          mOut[i] = m[from];
+          rOut[i] = r[from];
+          vOut[i] = v[from];
+          aOut[i] = a[from];
+        } else {
+          mOut[i] = this->addedBodies[from - oldCount].m;
+          rOut[i] = this->addedBodies[from - oldCount].r;
+          vOut[i] = this->addedVelocities[from - oldCount];
+          aOut[i] = Vec3(0, 0, 0);
+        }
+      }
+
+      #pragma omp for schedule(static)
+      for(unsigned i = 0; i < count; i++) this->m[i] = mOut[i];
+    }
+  }
+  this->NodeBarrier();
+  if(!grow) this->SwapBuffers();
+  else if(this->config.sharedMemory) {
+    MPI_Win_unlock_all(oldWindow);
+    MPI_Win_free(&oldWindow);
+  }
+
+  // New bodies take ids in the order they were queued
+  std::vector<unsigned> ids(count);
+  for(unsigned i = 0; i < count; i++) {
+    ids[i] = order[i] < oldCount ?
+      this->bodyIds[order[i]] : this->createdCount + order[i] - oldCount;
+  }
+  this->bodyIds.swap(ids);
+  this->createdCount += addedCount;
+  this->IndexBodies();
+  this->addedBodies.clear();
+  this->addedVelocities.clear();
+  this->removedIds.clear();
+
+  // New bodies have no forces yet, nor any step history
+  this->forcesPrimed = false;
+  this->timestep.Reset();
+
+  // Device buffers follow the host capacity & this rank's domain, the
+  // kernels keep their program & only need pointing at the new buffers
+  if(grow || this->GetDomainSize() > this->domainCapacity) {
+    this->domainCapacity =
+      std::max(this->GetDomainSize(), 2 * this->domainCapacity);
+    this->AllocateBuffersCL();
+    this->SetKernelBufferArgs();
+  }
+  this->SetKernelDomainArgs();
+  this->deviceStale = true;
+  return true;
+}
+
+
+//====[ADAPTIVE TIMESTEP]====================================================//
+
+// Largest acceleration on this rank's domain, for paths whose kernels don't
+// reduce it themselves. Called with the new accelerations in aNext.
+void Universe::RecordDomainMax(void) {
+  float aMax2 = 0;
+
+  #pragma omp parallel for schedule(static) reduction(max:aMax2)
+  for(unsigned i = this->GetDomainStart(); i < this->GetDomainEnd(); i++) {
+    aMax2 = std::max(aMax2, Dot(this->aNext[i], this->aNext[i]));
+  }
+
+  this->accelerationMax2 = aMax2;
+  this->jerkMax2 = 0;
+}
+
+
+// Combine the per rank maxima & set the next timestep
+void Universe::AdaptTimestep(void) {
+  float local[2] = {this->accelerationMax2, this->jerkMax2};
+  float global[2];
+  MPI_Allreduce(local, global, 2, MPI_FLOAT, MPI_MAX, this->comm);
+
+  this->SetTimestepSize(this->timestep.Next(
+    this->dt, this->e, sqrt(global[0]), sqrt(global[1])));
+}
+
+
+// Iterate with the selected compute engine
+double Universe::Iterate(engine_t const engine) {
+  if(!SupportsIntegrator(engine, this->config)) {
+    throw std::invalid_argument(
+      "Higher order integrators need the cpu or opencl engine, no overlap");
+  }
+  if(!SupportsShortRange(engine, this->config)) {
+    throw std::invalid_argument(
+      "Short range forces need the cpu or opencl engine, no overlap, "
+      "shared memory or hermite");
+  }
+
+  // Bodies added & removed since the last step
+  double tChanges = MPI_Wtime();
+  this->ApplyChanges();
+  tChanges = MPI_Wtime() - tChanges;
+
+  float dtStep = this->dt;
+
+  // Other paths work from the host copies of the state
+  bool resident = this->Resident(engine);
+  if(!resident) this->FetchResident();
+
+  this->forceEvaluations = 0;
+  double tIteration;
+  if(resident) {
+    tIteration = this->IterateResident();
+  } else if(this->config.overlapExchange && engine != ENGINE_PM) {
+    tIteration = this->IterateOverlapped(engine);
+  } else {
+    switch(engine) {
+      case ENGINE_CPU: tIteration = this->Iterate(); break;
+      case ENGINE_CPU_SYMMETRIC: tIteration = this->IterateSymmetric(); break;
+      case ENGINE_PM: tIteration = this->IteratePM(); break;
+      default: tIteration = this->IterateCL(); break;
+    }
+  }
+  if(!resident) this->deviceStale = true;
+
+  // Fused paths evaluate once, the mesh & cutoff have no fixed pair count
+  StepStats stats;
+  stats.tChanges = tChanges;
+  stats.tForces = tIteration;
+  if(engine != ENGINE_PM && this->config.cutoff <= 0) {
+    stats.interactions =
+      (double)std::max(this->forceEvaluations, 1u) *
+      this->sourceCount * (this->bodyCount - 1.0);
+  }
+
+  this->simulationTime += dtStep;
+  tIteration += tChanges;
+
+  // Collisions are resolved between steps
+  if(this->config.collisionRadius > 0) {
+    double tStart = MPI_Wtime();
+    unsigned merged = this->MergeCollisions();
+    if(merged && !MyRank(this->comm)) {
+      std::cout << "Merged " << merged << " bodies, ";
+      std::cout << this->bodyCount << " remain\n";
+    }
+    stats.tCollisions = MPI_Wtime() - tStart;
+    tIteration += stats.tCollisions;
+  }
+
+  // Restore locality every so often
+  if(this->config.reorderInterval &&
+     ++this->stepsSinceReorder >= this->config.reorderInterval) {
+    double tStart = MPI_Wtime();
+    this->Reorder();
+    this->stepsSinceReorder = 0;
+    stats.tReorder = MPI_Wtime() - tStart;
+    tIteration += stats.tReorder;
+  }
+
+  // Pick the next step from the forces just evaluated
+  if(this->timestep.Enabled()) {
+    double tStart = MPI_Wtime();
+    this->AdaptTimestep();
+    stats.tTimestep = MPI_Wtime() - tStart;
+    tIteration += stats.tTimestep;
+  }
+
+  this->stepStats = stats;
+  return tIteration;
+}
+
+
+// Get a vector of body data from the universe
+std::vector<Body> Universe::GetBodyData(void) {
+  this->FinishExchange();
+  this->FetchResident();
+  std::vector<Body> bodyData(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    bodyData[i].m = this->m[this->bodyIndex[i]];
+    bodyData[i].r = this->r[this->bodyIndex[i]];
   }
   return bodyData;
 }
 
 
-// Free integrator term buffers
-Universe::~Universe(void) {
-  delete [] this->m;
-  delete [] this->r;
-  delete [] this->v;
-  delete [] this->a;
-  delete [] this->rNext;
-  delete [] this->vNext;
-  delete [] this->aNext;
+// Gets this rank's share of the bodies in creation order, reusing the
+// caller's buffer. Other ranks' slices may still be in flight, which only
+// matters once bodies are stored out of creation order. Short range mode
+// gathers them first, so then every rank must call this.
+void Universe::GetDomainBodyData(std::vector<Body>& bodyData) {
+  this->FetchResident();
+  if(!this->storageOrdered) this->FinishExchange();
+  if(!this->storageOrdered && this->config.cutoff > 0) {
+    this->AllgatherDomain(this->r);
+  }
+
+  unsigned domainStart = this->GetDomainStart();
+  bodyData.resize(this->GetDomainSize());
+  for(unsigned i = 0; i < bodyData.size(); i++) {
+    bodyData[i].m = this->m[this->bodyIndex[domainStart + i]];
+    bodyData[i].r = this->r[this->bodyIndex[domainStart + i]];
+  }
+}
+
+
+std::vector<unsigned> Universe::GetBodyIds(void) {
+  std::vector<unsigned> ids(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    ids[i] = this->bodyIds[this->bodyIndex[i]];
+  }
+  return ids;
+}
+
+
+// Only positions are kept current by overlapped exchange
+std::vector<Vec3> Universe::GetVelocityData(void) {
+  this->FetchResident();
+  std::vector<Vec3> velocityData(this->bodyCount);
+  for(unsigned i = 0; i < this->bodyCount; i++) {
+    velocityData[i] = this->v[this->bodyIndex[i]];
+  }
+  return velocityData;
+}
+
+
+void Universe::GetDomainVelocityData(std::vector<Vec3>& velocityData) {
+  this->FetchResident();
+  if(!this->storageOrdered) this->FinishExchange();
+  if(!this->storageOrdered && this->config.cutoff > 0) {
+    this->AllgatherDomain(this->v);
+  }
+
+  unsigned domainStart = this->GetDomainStart();
+  velocityData.resize(this->GetDomainSize());
+  for(unsigned i = 0; i < velocityData.size(); i++) {
+    velocityData[i] = this->v[this->bodyIndex[domainStart + i]];
+  }
+}
+
+
+double Universe::GetSimulationTime(void) {
+  return this->simulationTime;
+}
+
+
+StepStats Universe::GetStepStats(void) {
+  return this->stepStats;
+}
+
+
+void Universe::ProjectDensity(DensityProjection& projection) {
+  this->FetchResident();
+  projection.Deposit(
+    this->m, this->r, this->GetDomainStart(), this->GetDomainEnd());
+}
+
+
+// Linking needs every source's current position, short range forces only
+// keep those near each domain current
+void Universe::FindHalos(HaloFinder& finder) {
+  this->FetchResident();
+  this->FinishExchange();
+  if(this->config.cutoff > 0) this->AllgatherDomain(this->r);
+  finder.Find(
+    this->m, this->r, this->v, this->bodyCount,
+    this->GetDomainStart(), this->GetDomainSourceEnd(), this->comm);
 }
@@ -1,3 +1,44 @@
+// Tunable parameters, normally supplied by the host as -D build options
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 64
+#endif
+#ifndef BODIES_PER_ITEM
+#define BODIES_PER_ITEM 1
+#endif
+#ifndef UNROLL_FACTOR
+#define UNROLL_FACTOR 1
+#endif
+#ifndef TILE_SIZE
+#define TILE_SIZE 64
+#endif
+
+
+// Integrator the host steps with, values match integrator_t
+#define INTEGRATOR_LEAPFROG 0
+#define INTEGRATOR_HERMITE 1
+#define INTEGRATOR_YOSHIDA 2
+#ifndef INTEGRATOR
+#define INTEGRATOR INTEGRATOR_LEAPFROG
+#endif
+
+// Hermite needs the jerk from the force loop, velocities are staged too
+#if INTEGRATOR == INTEGRATOR_HERMITE
+#define USE_JERK 1
+#define JERK_TILE_SIZE TILE_SIZE
+#else
+#define USE_JERK 0
+#define JERK_TILE_SIZE 1
+#endif
+
+// Pair force of the short range mode, values match force_law_t
+#define FORCE_TRUNCATED 0
+#define FORCE_SHIFTED 1
+#define FORCE_SCREENED 2
+#ifndef FORCE_LAW
+#define FORCE_LAW FORCE_TRUNCATED
+#endif
+
+
 float3 ReadF3(__global float const* f, int const i) {
   float3 f3 = {f[i * 3], f[(i * 3) + 1], f[(i * 3) + 2]};
   return f3;
@@ -27,8 +68,120 @@ float3 BodyBodyAcceleration(
 }
 
 
-// Simple brute-force kernel with leapfrog integrator
-__kernel void leapfrog(
+// Acceleration & jerk (its time derivative) due to body j
+void BodyBodyAccelerationJerk(
+  float3 ri, float3 rj,   // Positions
+  float3 vi, float3 vj,   // Velocities
+  float mj, float e2,
+  float3* ai, float3* ji) {
+
+  float3 r = rj - ri;
+  float3 v = vj - vi;
+  float r2 = r.x * r.x + r.y * r.y + r.z * r.z + e2;
+  float r6 = r2 * r2 * r2;
+  float s = mj / sqrt(r6);
+  float rv = 3 * (r.x * v.x + r.y * v.y + r.z * v.z) / r2;
+  *ai += r * s;
+  *ji += (v - (r * rv)) * s;
+}
+
+
+// Interaction of body k of this work item with tile entry t
+#if USE_JERK
+#define INTERACT(k, t) \
+  BodyBodyAccelerationJerk( \
+    rInternal[k], rTile[t], vInternal[k], vTile[t], mTile[t], e2, \
+    &aInternal[k], &jInternal[k])
+#else
+#define INTERACT(k, t) \
+  aInternal[k] = BodyBodyAcceleration( \
+    rInternal[k], rTile[t], 0, mTile[t], e2, aInternal[k])
+#endif
+
+
+// Accumulate acceleration on this work item's bodies due to sources in
+// [sourceStart, sourceEnd), staged TILE_SIZE bodies at a time through local
+// memory. Must be reached by every work item in the group.
+void AccumulateTiles(
+  __global float const* m,
+  __global float const* r,
+  __global float const* v,
+  __local float3* rTile,
+  __local float3* vTile,
+  __local float* mTile,
+  float3 const* rInternal,
+  float3 const* vInternal,
+  float3* aInternal,
+  float3* jInternal,
+  float const e2,
+  int const sourceStart,
+  int const sourceEnd) {
+
+  int const localId = get_local_id(0);
+
+  for(int tileStart = sourceStart;
+      tileStart < sourceEnd;
+      tileStart += TILE_SIZE) {
+    int tileCount = min(TILE_SIZE, sourceEnd - tileStart);
+
+    // Stage the tile in local memory
+    for(int t = localId; t < tileCount; t += WORK_GROUP_SIZE) {
+      rTile[t] = ReadF3(r, tileStart + t);
+      mTile[t] = m[tileStart + t];
+#if USE_JERK
+      vTile[t] = ReadF3(v, tileStart + t);
+#endif
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The compiler unrolls & handles the remainder of a partial tile
+    #pragma unroll UNROLL_FACTOR
+    for(int t = 0; t < tileCount; t++) {
+      for(int k = 0; k < BODIES_PER_ITEM; k++) INTERACT(k, t);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+
+// Leapfrog update of domain body i given its new acceleration
+void IntegrateBody(
+  __global float const* r,
+  __global float const* v,
+  __global float const* a,
+  __global float* rNext,
+  __global float* vNext,
+  __global float* aNext,
+  float3 const aNextInternal,
+  float const dt,
+  int const i,
+  int const domainOffset) {
+
+  // Compute next position
+  float3 rNextInternal =
+    ReadF3(r, i + domainOffset) +
+    (ReadF3(v, i + domainOffset) * dt) +
+    ((ReadF3(a, i + domainOffset) * (dt * dt)) / 2);
+
+  // Compute next velocity
+  float3 vNextInternal =
+    ReadF3(v, i + domainOffset) +
+    (((ReadF3(a, i + domainOffset) + aNextInternal) / 2) * dt);
+
+  // Write our outputs to the buffer
+  WriteF3(rNextInternal, rNext, i);
+  WriteF3(vNextInternal, vNext, i);
+  WriteF3(aNextInternal, aNext, i);
+}
+
+
+// Tiled brute-force kernel with leapfrog integrator
+// Each work group stages TILE_SIZE bodies in local memory at a time, each
+// work item integrates BODIES_PER_ITEM bodies strided by the global size.
+// The largest |a|^2 of each group is reduced for the timestep controller,
+// WORK_GROUP_SIZE must be a power of two.
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void leapfrog(
   // Input buffers
   __global float const* m,  // Body mass
   __global float const* r,  // Position, current
@@ -44,36 +197,273 @@ __kernel void leapfrog(
   float const e2,           // Damping factor
   // Execution control
   int const bodyCount,
-  int const domainOffset) {
+  int const domainOffset,
+  int const domainSize,
+  // Outputs for the timestep controller
+  __global float* aMax2) {  // Largest |a|^2, one per work group
 
-  // Get the index for this kernel
-  int i = get_global_id(0) + domainOffset;
+  // Local copy of the current tile
+  __local float3 rTile[TILE_SIZE];
+  __local float3 vTile[JERK_TILE_SIZE];
+  __local float mTile[TILE_SIZE];
 
-  // Reset value of aNext
-  float3 aNextInternal = 0;
+  int const stride = get_global_size(0);
 
-  // Compute acceleration due to other bodies
-  for(int j = 0; j < bodyCount; j++) {
-    aNextInternal = BodyBodyAcceleration(
-      ReadF3(r, i), ReadF3(r, j), m[i], m[j], e2, aNextInternal);
+  // Load the bodies this work item is responsible for
+  float3 rInternal[BODIES_PER_ITEM];
+  float3 vInternal[BODIES_PER_ITEM];
+  float3 aNextInternal[BODIES_PER_ITEM];
+  float3 jNextInternal[BODIES_PER_ITEM];
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = get_global_id(0) + (k * stride);
+    rInternal[k] = (i < domainSize) ? ReadF3(r, i + domainOffset) : 0;
+    vInternal[k] = (i < domainSize) ? ReadF3(v, i + domainOffset) : 0;
+    aNextInternal[k] = 0;
+    jNextInternal[k] = 0;
   }
 
-  // Apply universal gravitational constant
-  aNextInternal = aNextInternal * G;
+  // Compute acceleration due to all bodies
+  AccumulateTiles(
+    m, r, v, rTile, vTile, mTile, rInternal, vInternal,
+    aNextInternal, jNextInternal, e2, 0, bodyCount);
 
-  // Compute next position
-  float3 rNextInternal =
-    ReadF3(r, i) +
-    (ReadF3(v, i) * dt) +
-    ((ReadF3(a, i) * (dt * dt)) / 2);
+  float itemMax2 = 0;
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = get_global_id(0) + (k * stride);
+    if(i >= domainSize) break;
 
-  // Compute next velocity
-  float3 vNextInternal =
-    ReadF3(v, i) +
-    (((ReadF3(a, i) + aNextInternal) / 2) * dt);
+    // Apply universal gravitational constant & integrate
+    float3 aScaled = aNextInternal[k] * G;
+    itemMax2 = fmax(itemMax2, dot(aScaled, aScaled));
+    IntegrateBody(
+      r, v, a, rNext, vNext, aNext, aScaled, dt, i, domainOffset);
+  }
 
-  // Write our outputs to the buffer
-  WriteF3(rNextInternal, rNext, i - domainOffset);
-  WriteF3(vNextInternal, vNext, i - domainOffset);
-  WriteF3(aNextInternal, aNext, i - domainOffset);
+  // Reduce the group's maximum in local memory
+  __local float groupMax2[WORK_GROUP_SIZE];
+  int const localId = get_local_id(0);
+  groupMax2[localId] = itemMax2;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(int s = WORK_GROUP_SIZE / 2; s > 0; s >>= 1) {
+    if(localId < s) {
+      groupMax2[localId] = fmax(groupMax2[localId], groupMax2[localId + s]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if(localId == 0) aMax2[get_group_id(0)] = groupMax2[0];
+}
+
+
+// Accumulate unscaled acceleration on domain bodies due to a range of
+// sources, used to fold in remote slices of positions as they arrive and
+// for each force evaluation of the higher order integrators
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void accumulate(
+  __global float const* m,  // Body mass
+  __global float const* r,  // Position, current
+  __global float* aNext,    // Acceleration, partial sums
+  float const e2,           // Damping factor
+  int const domainOffset,
+  int const domainSize,
+  int const sourceStart,    // First source body
+  int const sourceCount,    // Number of source bodies
+  int const overwrite,      // Start new sums rather than adding
+  __global float const* v,  // Velocity, current
+  __global float* jNext) {  // Jerk, partial sums, hermite only
+
+  __local float3 rTile[TILE_SIZE];
+  __local float3 vTile[JERK_TILE_SIZE];
+  __local float mTile[TILE_SIZE];
+
+  int const stride = get_global_size(0);
+
+  float3 rInternal[BODIES_PER_ITEM];
+  float3 vInternal[BODIES_PER_ITEM];
+  float3 aNextInternal[BODIES_PER_ITEM];
+  float3 jNextInternal[BODIES_PER_ITEM];
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = get_global_id(0) + (k * stride);
+    rInternal[k] = (i < domainSize) ? ReadF3(r, i + domainOffset) : 0;
+    vInternal[k] = (i < domainSize) ? ReadF3(v, i + domainOffset) : 0;
+    aNextInternal[k] = (i < domainSize && !overwrite) ? ReadF3(aNext, i) : 0;
+    jNextInternal[k] = (i < domainSize && !overwrite) ? ReadF3(jNext, i) : 0;
+  }
+
+  AccumulateTiles(
+    m, r, v, rTile, vTile, mTile, rInternal, vInternal,
+    aNextInternal, jNextInternal, e2,
+    sourceStart, sourceStart + sourceCount);
+
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = get_global_id(0) + (k * stride);
+    if(i >= domainSize) break;
+    WriteF3(aNextInternal[k], aNext, i);
+#if USE_JERK
+    WriteF3(jNextInternal[k], jNext, i);
+#endif
+  }
+}
+
+
+// Scale s such that a source at r2 within the cutoff adds dr * m * s to the
+// unscaled acceleration, matches PairScale() on the host
+float PairScale(
+  float const r2, float const e2,
+  float const shift, float const screeningInverse) {
+
+  float rInverse = 1.0f / sqrt(r2);
+  float d2 = r2 + e2;
+#if FORCE_LAW == FORCE_SHIFTED
+  return ((1.0f / d2) - shift) * rInverse;
+#elif FORCE_LAW == FORCE_SCREENED
+  float x = r2 * rInverse * screeningInverse;
+  return exp(-x) * (1.0f + x) * rInverse / d2;
+#else
+  return rInverse / d2;
+#endif
+}
+
+
+// Hash of a cell into the table, matches SpatialHash::Bucket()
+uint CellBucket(int const x, int const y, int const z, uint const tableMask) {
+  return (
+    ((uint)x * 73856093u) ^
+    ((uint)y * 19349663u) ^
+    ((uint)z * 83492791u)) & tableMask;
+}
+
+
+// Accumulate unscaled short range acceleration on domain bodies due to the
+// sources in the 27 cells around each. Sources are stored in bucket order,
+// so every bucket is a contiguous range, see SpatialHash.
+__kernel void accumulate_cells(
+  __global float const* r,            // Position, current
+  __global float* aNext,              // Acceleration, unscaled
+  __global float const* cellM,        // Source mass, bucket order
+  __global float const* cellR,        // Source position, bucket order
+  __global uint const* bucketStart,   // Offset of each bucket, +1 end
+  uint const tableMask,
+  float const cellInverse,
+  float const e2,                     // Damping factor
+  float const cutoff2,
+  float const shift,                  // Shifted force at the cutoff
+  float const screeningInverse,
+  int const domainOffset,
+  int const domainSize) {
+
+  int i = get_global_id(0);
+  if(i >= domainSize) return;
+
+  float3 ri = ReadF3(r, i + domainOffset);
+  int cx = (int)floor(ri.x * cellInverse);
+  int cy = (int)floor(ri.y * cellInverse);
+  int cz = (int)floor(ri.z * cellInverse);
+
+  // Several cells may share a bucket, visit each bucket once
+  uint buckets[27];
+  int bucketCount = 0;
+  for(int dx = -1; dx <= 1; dx++) {
+    for(int dy = -1; dy <= 1; dy++) {
+      for(int dz = -1; dz <= 1; dz++) {
+        uint b = CellBucket(cx + dx, cy + dy, cz + dz, tableMask);
+        int seen = 0;
+        for(int k = 0; k < bucketCount; k++) seen |= buckets[k] == b;
+        if(!seen) buckets[bucketCount++] = b;
+      }
+    }
+  }
+
+  float3 ai = 0;
+  for(int k = 0; k < bucketCount; k++) {
+    uint end = bucketStart[buckets[k] + 1];
+    for(uint n = bucketStart[buckets[k]]; n < end; n++) {
+      float3 dr = ReadF3(cellR, n) - ri;
+      float r2 = dot(dr, dr);
+      if(r2 > 0 && r2 < cutoff2) {
+        ai += dr * (cellM[n] * PairScale(r2, e2, shift, screeningInverse));
+      }
+    }
+  }
+  WriteF3(ai, aNext, i);
+}
+
+
+// Apply the gravitational constant to accumulated accelerations & integrate
+__kernel void integrate(
+  __global float const* r,  // Position, current
+  __global float const* v,  // Velocity, current
+  __global float const* a,  // Acceleration, current
+  __global float* rNext,    // Position, next
+  __global float* vNext,    // Velocity, next
+  __global float* aNext,    // Acceleration, partial sums in, next out
+  float const dt,           // Time step
+  float const G,            // Gravitational constant
+  int const domainOffset,
+  int const domainSize) {
+
+  int i = get_global_id(0);
+  if(i >= domainSize) return;
+
+  IntegrateBody(
+    r, v, a, rNext, vNext, aNext,
+    ReadF3(aNext, i) * G, dt, i, domainOffset);
+}
+
+
+// Tiled brute-force leapfrog over many independent universes packed into
+// the same buffers, each with its own G, dt & softening. Work groups never
+// span universes, so the tile loop's barriers stay uniform.
+__kernel __attribute__((reqd_work_group_size(WORK_GROUP_SIZE, 1, 1)))
+void ensemble(
+  // Input buffers
+  __global float const* m,  // Body mass
+  __global float const* r,  // Position, current
+  __global float const* v,  // Velocity, current
+  __global float const* a,  // Acceleration, current
+  // Output buffers
+  __global float* rNext,    // Position, next
+  __global float* vNext,    // Velocity, next
+  __global float* aNext,    // Acceleration, next
+  // Universes
+  __global float4 const* params,      // G, dt, e^2 of each universe
+  __global int4 const* universes,     // Body offset & count, first group
+                                      // & group count of each universe
+  __global int const* groupUniverse) {  // Universe of each work group
+
+  __local float3 rTile[TILE_SIZE];
+  __local float3 vTile[JERK_TILE_SIZE];
+  __local float mTile[TILE_SIZE];
+
+  int const group = get_group_id(0);
+  int const u = groupUniverse[group];
+  float4 const p = params[u];
+  int4 const layout = universes[u];
+  int const stride = layout.w * WORK_GROUP_SIZE;
+  int const item =
+    ((group - layout.z) * WORK_GROUP_SIZE) + (int)get_local_id(0);
+
+  float3 rInternal[BODIES_PER_ITEM];
+  float3 vInternal[BODIES_PER_ITEM];
+  float3 aNextInternal[BODIES_PER_ITEM];
+  float3 jNextInternal[BODIES_PER_ITEM];
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = item + (k * stride);
+    rInternal[k] = (i < layout.y) ? ReadF3(r, layout.x + i) : 0;
+    vInternal[k] = (i < layout.y) ? ReadF3(v, layout.x + i) : 0;
+    aNextInternal[k] = 0;
+    jNextInternal[k] = 0;
+  }
+
+  // Compute acceleration due to the rest of this universe
+  AccumulateTiles(
+    m, r, v, rTile, vTile, mTile, rInternal, vInternal,
+    aNextInternal, jNextInternal, p.z, layout.x, layout.x + layout.y);
+
+  for(int k = 0; k < BODIES_PER_ITEM; k++) {
+    int i = item + (k * stride);
+    if(i >= layout.y) break;
+    IntegrateBody(
+      r, v, a, rNext, vNext, aNext,
+      aNextInternal[k] * p.x, p.y, layout.x + i, 0);
+  }
 }
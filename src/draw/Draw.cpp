@@ -24,6 +24,27 @@ GLT::Mesh MakeMeshFromBodyList(std::vector<Body> const& bodies) {
 }
 
 
+// One point per lit pixel, brightness as colour
+GLT::Mesh MakeMeshFromDensity(DensityImage const& image) {
+  std::vector<GLT::vertex_t> v;
+  float pixelSize = (2 * image.extent) / image.resolution;
+  for(unsigned y = 0; y < image.resolution; y++) {
+    for(unsigned x = 0; x < image.resolution; x++) {
+      uint8_t level = image.pixels[(y * image.resolution) + x];
+      if(!level) continue;
+
+      GLT::vertex_t p;
+      p.position.x = ((x + 0.5f) * pixelSize) - image.extent;
+      p.position.y = ((y + 0.5f) * pixelSize) - image.extent;
+      p.position.z = 0;
+      p.normal = glm::vec3(level / 255.0f);
+      v.push_back(p);
+    }
+  }
+  return GLT::Mesh(v);
+}
+
+
 // Override the mesh draw routine
 void GLT::Mesh::Draw(Camera& camera, ShaderProgram& shader, glm::mat4& m) {
   glm::mat4 mvp = camera.GetProjMat() * camera.GetViewMat() * m;
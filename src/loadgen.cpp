@@ -0,0 +1,128 @@
+// Standard
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+// External
+#include <optparse.hpp>
+
+// Internal
+#include "Master.hpp"
+#include "comm/Client.hpp"
+
+
+void AddOptions(OptionParser& opt) {
+  opt.Add(Option("address", 'a', ARG_TYPE_STRING,
+                 "IP address of host to connect to",
+                 {"127.0.0.1"}));
+  opt.Add(Option("port", 'p', ARG_TYPE_INT,
+                 "Port to use for connection",
+                 {_MPIGRAV_DEFAULT_PORT}));
+  opt.Add(Option("connections", 'n', ARG_TYPE_INT,
+                 "Number of concurrent connections to open",
+                 {"100"}));
+  opt.Add(Option("slow", 's', ARG_TYPE_INT,
+                 "How many of the connections to throttle",
+                 {"0"}));
+  opt.Add(Option("slowrate", 'r', ARG_TYPE_FLOAT,
+                 "Read rate of throttled connections in bytes per second",
+                 {"65536"}));
+  opt.Add(Option("duration", 'd', ARG_TYPE_FLOAT,
+                 "How long to run for in seconds",
+                 {"10"}));
+  opt.Add(Option("interval", 'i', ARG_TYPE_FLOAT,
+                 "Seconds between aggregate reports",
+                 {"1"}));
+}
+
+
+int main(int argc, char **argv) {
+  OptionParser opt(argc, argv, "mpigrav server load generator");
+  AddOptions(opt);
+
+  std::string address = opt.Get("address");
+  int port = opt.Get("port");
+  int connectionCount = opt.Get("connections");
+  int slowCount = opt.Get("slow");
+  float slowRate = opt.Get("slowrate");
+  float runTime = opt.Get("duration");
+  float interval = opt.Get("interval");
+
+  std::cout << "\n[LOAD PARAMETERS]\n";
+  std::cout << "Server: " << address << ":" << port << "\n";
+  std::cout << "Connections: " << connectionCount << "\n";
+  std::cout << "Throttled: " << slowCount << " at " << slowRate << " B/s\n";
+
+  // Open connections, the first slowCount are throttled
+  std::vector<std::unique_ptr<Client>> clients;
+  for(int k = 0; k < connectionCount; k++) {
+    try {
+      clients.emplace_back(new Client(address, port, false));
+      if(k < slowCount) clients.back()->SetReadRate(slowRate);
+    } catch(std::exception& e) {
+      std::cout << "Connection " << k << " failed: " << e.what() << "\n";
+      break;
+    }
+  }
+  std::cout << "Opened " << clients.size() << " connections\n";
+  if(clients.empty()) return 1;
+
+  std::cout << "\n[AGGREGATE]\n";
+  std::cout << std::fixed << std::setprecision(3);
+
+  using namespace std::chrono;
+  high_resolution_clock::time_point tStart = high_resolution_clock::now();
+  high_resolution_clock::time_point tReport = tStart;
+  std::vector<ClientStats> last(clients.size());
+  double elapsed = 0;
+
+  while(elapsed < runTime) {
+    tReport += duration_cast<high_resolution_clock::duration>(
+      std::chrono::duration<double>(interval));
+    std::this_thread::sleep_until(tReport);
+    elapsed = std::chrono::duration<double>(tReport - tStart).count();
+
+    // Totals over this interval
+    unsigned long frames = 0;
+    unsigned long bytes = 0;
+    double latencySum = 0;
+    double latencyMax = 0;
+    unsigned connected = 0;
+    for(unsigned k = 0; k < clients.size(); k++) {
+      ClientStats s = clients[k]->GetStats(true);
+      frames += s.frames - last[k].frames;
+      bytes += s.bytes - last[k].bytes;
+      latencySum += s.latencySum - last[k].latencySum;
+      latencyMax = std::max(latencyMax, s.latencyIntervalMax);
+      connected += clients[k]->Connected();
+      last[k] = s;
+    }
+
+    std::cout << "t " << elapsed << "s) connected: " << connected;
+    std::cout << ", frames/s: " << frames / interval;
+    std::cout << ", egress: " << (bytes / interval) / 1e6 << " MB/s";
+    std::cout << ", latency mean: ";
+    std::cout << (frames ? (latencySum / frames) * 1e3 : 0) << " ms";
+    std::cout << ", max: " << latencyMax * 1e3 << " ms\n";
+  }
+
+  // Per connection summary over the whole run
+  std::cout << "\n[CONNECTIONS]\n";
+  std::cout << "id\tthrottled\tframes/s\tMB/s\tlatency mean ms\tmax ms\n";
+  for(unsigned k = 0; k < clients.size(); k++) {
+    ClientStats s = clients[k]->GetStats();
+    std::cout << k << "\t" << ((int)k < slowCount ? "yes" : "no");
+    std::cout << "\t\t" << s.frames / elapsed;
+    std::cout << "\t" << (s.bytes / elapsed) / 1e6;
+    std::cout << "\t" << (s.frames ? (s.latencySum / s.frames) * 1e3 : 0);
+    std::cout << "\t\t" << s.latencyMax * 1e3;
+    if(!clients[k]->Connected()) std::cout << "\tdisconnected";
+    std::cout << "\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Standard
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+// External
+#include <optparse.hpp>
+
+// Internal
+#include "Master.hpp"
+#include "comm/Server.hpp"
+#include "comm/Metrics.hpp"
+#include "comm/Trajectory.hpp"
+
+
+void AddOptions(OptionParser& opt) {
+  opt.Add(Option("file", 'f', ARG_TYPE_STRING,
+                 "Trajectory recording to play, see the server's record option",
+                 {"trajectory.mpigrav"}));
+  opt.Add(Option("port", 'p', ARG_TYPE_INT,
+                 "Port to use for communication with clients",
+                 {_MPIGRAV_DEFAULT_PORT}));
+  opt.Add(Option("metricsport", 'M', ARG_TYPE_INT,
+                 "Local port serving prometheus metrics, 0 = off",
+                 {"0"}));
+  opt.Add(Option("updaterate", 'u', ARG_TYPE_INT,
+                 "How many times per second to update clients",
+                 {"10"}));
+  opt.Add(Option("framerate", 'r', ARG_TYPE_FLOAT,
+                 "Recorded frames played per second at normal speed",
+                 {"10"}));
+  opt.Add(Option("speed", 's', ARG_TYPE_FLOAT,
+                 "Playback speed factor",
+                 {"1"}));
+  opt.Add(Option("seek", 'S', ARG_TYPE_INT,
+                 "Frame to start playing from, negative counts from the end",
+                 {"0"}));
+  opt.Add(Option("loop", 'l', ARG_TYPE_INT,
+                 "Start again from the seek frame at the end, 0 = off",
+                 {"0"}));
+}
+
+
+int main(int argc, char **argv) {
+  OptionParser opt(argc, argv, "mpigrav trajectory replay server");
+  AddOptions(opt);
+
+  std::string path = opt.Get("file");
+  int commPort = opt.Get("port");
+  int metricsPort = opt.Get("metricsport");
+  int clientUpdateFrequency = opt.Get("updaterate");
+  float frameRate = opt.Get("framerate");
+  float speed = opt.Get("speed");
+  int seek = opt.Get("seek");
+  int loop = opt.Get("loop");
+
+  // Frames are sent straight out of the mapping
+  std::unique_ptr<TrajectoryReader> recording;
+  try {
+    recording.reset(new TrajectoryReader(path));
+  } catch(std::exception& e) {
+    std::cout << e.what() << "\n";
+    return 1;
+  }
+
+  int frameCount = recording->FrameCount();
+  if(!frameCount || frameRate * speed <= 0) {
+    std::cout << "Nothing to play\n";
+    return 1;
+  }
+  if(seek < 0) seek += frameCount;
+  seek = std::min(std::max(seek, 0), frameCount - 1);
+
+  std::cout << "\n[REPLAY PARAMETERS]\n";
+  std::cout << "Recording: " << path << ", " << frameCount << " frames\n";
+  std::cout << "Client update rate: " << clientUpdateFrequency << "\n";
+  std::cout << "Communication port: " << commPort << "\n";
+  if(metricsPort > 0) std::cout << "Metrics port: " << metricsPort << "\n";
+  std::cout << "Frame rate: " << frameRate << " x " << speed << "\n";
+  std::cout << "Starting frame: " << seek << "\n";
+  std::cout << "Loop: " << (loop ? "Yes" : "No") << "\n";
+
+  // The recording outlives the server, which may still be sending from it
+  Metrics metrics;
+  Server server(std::vector<Body>{});
+  if(metricsPort > 0) {
+    metrics.Start(metricsPort);
+    server.SetMetrics(&metrics);
+  }
+  server.SetBodyFrame(recording->Bodies(seek), recording->BodyCount(seek));
+  server.Start(commPort, clientUpdateFrequency);
+
+  std::cout << "\n[REPLAY BEGINS]\n";
+
+  // Frames are due at fixed times from the start of each pass, so a slow
+  // frame doesn't push the rest back
+  using namespace std::chrono;
+  duration<double> framePeriod(1.0 / (frameRate * speed));
+  high_resolution_clock::time_point tPass = high_resolution_clock::now();
+  int frame = seek;
+  while(true) {
+    std::this_thread::sleep_until(
+      tPass + duration_cast<high_resolution_clock::duration>(
+        framePeriod * (frame - seek + 1)));
+
+    if(++frame >= frameCount) {
+      if(!loop) break;
+      frame = seek;
+      tPass = high_resolution_clock::now();
+      std::cout << "Looping from frame " << seek << "\n";
+    }
+    server.SetBodyFrame(recording->Bodies(frame), recording->BodyCount(frame));
+  }
+
+  std::cout << "Replay finished\n";
+  return 0;
+}
@@ -2,6 +2,9 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <string>
+#include <algorithm>
+#include <memory>
 
 // External
 #include "omp.h"
@@ -11,8 +14,14 @@
 // Internal
 #include "Master.hpp"
 #include "Body.hpp"
+#include "DensityImage.hpp"
 #include "compute/Universe.hpp"
+#include "compute/Ensemble.hpp"
+#include "compute/Snapshot.hpp"
+#include "compute/Halos.hpp"
+#include "comm/Trajectory.hpp"
 #include "comm/Server.hpp"
+#include "comm/Metrics.hpp"
 #include "compute/MiscMPI.hpp"
 
 
@@ -23,15 +32,31 @@ void AddOptions(OptionParser& opt) {
   opt.Add(Option("nbodies", 'n', ARG_TYPE_INT,
                  "Number of bodies to use for the simulation",
                  {"2"}));
+  opt.Add(Option("tracers", 'q', ARG_TYPE_INT,
+                 "Massless tracer bodies added to the simulation",
+                 {"0"}));
   opt.Add(Option("timestep", 'T', ARG_TYPE_FLOAT,
                  "Major time step in seconds",
                  {"1"}));
+  opt.Add(Option("courant", 'C', ARG_TYPE_FLOAT,
+                 "Adaptive timestep accuracy parameter, 0 = fixed timestep",
+                 {"0"}));
+  opt.Add(Option("mintimestep", 'N', ARG_TYPE_FLOAT,
+                 "Lower bound for the adaptive timestep, 0 = none",
+                 {"0"}));
+  opt.Add(Option("maxtimestep", 'X', ARG_TYPE_FLOAT,
+                 "Upper bound for the adaptive timestep, 0 = none",
+                 {"0"}));
   opt.Add(Option("damping", 'd', ARG_TYPE_FLOAT,
                  "Damping coefficient to stop infinities making a mess of things",
                  {"1"}));
   opt.Add(Option("port", 'p', ARG_TYPE_INT,
                  "Port to listen for clients on",
                  {_MPIGRAV_DEFAULT_PORT}));
+  opt.Add(Option("metricsport", 'M', ARG_TYPE_INT,
+                 "Local port serving prometheus metrics, the next one for "
+                 "the compute ranks of an i/o rank run, 0 = off",
+                 {"0"}));
   opt.Add(Option("threadcount", 't', ARG_TYPE_INT,
                  "Number of threads to use for each instance",
                  {"1"}));
@@ -41,11 +66,236 @@ void AddOptions(OptionParser& opt) {
   opt.Add(Option("updaterate", 'u', ARG_TYPE_INT,
                  "How often the server should try to update connected clients",
                  {"10"}));
+  opt.Add(Option("engine", 'e', ARG_TYPE_STRING,
+                 "Compute engine: opencl, cpu, symmetric (cpu, pairs once) "
+                 "or pm (particle-mesh, periodic)",
+                 {"opencl"}));
+  opt.Add(Option("integrator", 'I', ARG_TYPE_STRING,
+                 "Integrator: leapfrog, hermite or yoshida (both 4th order)",
+                 {"leapfrog"}));
+  opt.Add(Option("iorank", 'O', ARG_TYPE_INT,
+                 "Reserve rank 0 for serving clients, others compute, 0 = off",
+                 {"0"}));
+  opt.Add(Option("snapshotinterval", 'S', ARG_TYPE_INT,
+                 "Steps between snapshots for the i/o rank, density stream "
+                 "or recording",
+                 {"10"}));
+  opt.Add(Option("stream", 'V', ARG_TYPE_STRING,
+                 "What clients are sent: bodies or density (projected image)",
+                 {"bodies"}));
+  opt.Add(Option("record", 'R', ARG_TYPE_STRING,
+                 "Record body snapshots to this file for mpigrav-replay",
+                 {""}));
+  opt.Add(Option("halointerval", 'A', ARG_TYPE_INT,
+                 "Steps between friends-of-friends group finds, 0 = off",
+                 {"0"}));
+  opt.Add(Option("linkinglength", 'l', ARG_TYPE_FLOAT,
+                 "Group linking length, 0 = 0.2 of the mean spacing",
+                 {"0"}));
+  opt.Add(Option("halomin", 'B', ARG_TYPE_INT,
+                 "Fewest members a group needs to be catalogued",
+                 {"20"}));
+  opt.Add(Option("halos", 'f', ARG_TYPE_STRING,
+                 "Write halo catalogues to this file, otherwise only a "
+                 "summary is printed",
+                 {""}));
+  opt.Add(Option("motion", 'v', ARG_TYPE_INT,
+                 "Send velocities so clients extrapolate between frames, "
+                 "0 = off",
+                 {"0"}));
+  opt.Add(Option("densityres", 'D', ARG_TYPE_INT,
+                 "Density image pixels along each axis",
+                 {"256"}));
+  opt.Add(Option("densityextent", 'x', ARG_TYPE_FLOAT,
+                 "Density image half width, centred on origin",
+                 {"2"}));
+  opt.Add(Option("ensemble", 'E', ARG_TYPE_INT,
+                 "Run this many independent universes, 0 = a single universe",
+                 {"0"}));
+  opt.Add(Option("tuning", 'k', ARG_TYPE_STRING,
+                 "Kernel autotuning mode: off, auto (tune on cache miss), force",
+                 {"auto"}));
+  opt.Add(Option("cachedir", 'c', ARG_TYPE_STRING,
+                 "Directory for cached kernel tuning data & program binaries",
+                 {_MPIGRAV_DEFAULT_CACHE_DIR}));
+  opt.Add(Option("hugepages", 'H', ARG_TYPE_STRING,
+                 "Huge pages for body buffers: off, transparent or explicit",
+                 {"transparent"}));
+  opt.Add(Option("pinthreads", 'P', ARG_TYPE_INT,
+                 "Pin each thread to a single cpu, 0 = off",
+                 {"0"}));
+  opt.Add(Option("overlap", 'o', ARG_TYPE_INT,
+                 "Overlap position exchange with local compute, 0 = off",
+                 {"0"}));
+  opt.Add(Option("sharedmemory", 'W', ARG_TYPE_INT,
+                 "Share one copy of the body buffers per node, 0 = off",
+                 {"0"}));
+  opt.Add(Option("residentsteps", 'Y', ARG_TYPE_INT,
+                 "Keep single rank opencl steps on the device, waiting every "
+                 "this many steps, 0 = off",
+                 {"0"}));
+  opt.Add(Option("reorder", 'Z', ARG_TYPE_INT,
+                 "Steps between sorting bodies along a morton curve, 0 = off",
+                 {"0"}));
+  opt.Add(Option("collisionradius", 'r', ARG_TYPE_FLOAT,
+                 "Merge bodies which come closer than this, 0 = off",
+                 {"0"}));
+  opt.Add(Option("cutoff", 'K', ARG_TYPE_FLOAT,
+                 "Short range forces, bodies further apart don't interact, "
+                 "0 = off",
+                 {"0"}));
+  opt.Add(Option("forcelaw", 'F', ARG_TYPE_STRING,
+                 "Short range pair force: truncated, shifted or screened",
+                 {"truncated"}));
+  opt.Add(Option("screening", 'L', ARG_TYPE_FLOAT,
+                 "Decay length of the screened short range force",
+                 {"1"}));
+  opt.Add(Option("meshsize", 'm', ARG_TYPE_INT,
+                 "Particle-mesh cells per axis, power of two, multiple of ranks",
+                 {"64"}));
+  opt.Add(Option("boxsize", 'b', ARG_TYPE_FLOAT,
+                 "Particle-mesh periodic box edge length, centred on origin",
+                 {"4"}));
+}
+
+
+// Random bodies within the unit sphere
+std::vector<Body> RandomBodies(int const n) {
+  std::vector<Body> bodies(n);
+  for(int i = 0; i < n; i++) {
+    bodies[i].m = 100000;
+    do {
+      bodies[i].r.x = ((float)((rand() % 65536) - 32768)) / 32768.0f;
+      bodies[i].r.y = ((float)((rand() % 65536) - 32768)) / 32768.0f;
+      bodies[i].r.z = ((float)((rand() % 65536) - 32768)) / 32768.0f;
+    } while(Magnitude(bodies[i].r) > 1.0f);
+  }
+  return bodies;
+}
+
+
+// Ensemble of independent universes with the same parameters & different
+// initial conditions, clients are shown the first one
+int RunEnsemble(
+  std::vector<Body> const& bodies, int const ensembleSize,
+  float const G, float const dt, float const d,
+  engine_t const engine, std::string const& cacheDir,
+  int const iterationLimit, int const commPort,
+  int const clientUpdateFrequency, int const metricsPort) {
+
+  std::vector<EnsembleMember> members(ensembleSize);
+  for(int k = 0; k < ensembleSize; k++) {
+    members[k].bodies = k ? RandomBodies(bodies.size()) : bodies;
+    members[k].G = G;
+    members[k].dt = dt;
+    members[k].e = d;
+  }
+  Ensemble ensemble(members, cacheDir);
+
+  Metrics metrics;
+  Server server(bodies);
+  if(!MyRank() && metricsPort > 0) {
+    metrics.Start(metricsPort);
+    server.SetMetrics(&metrics);
+  }
+  if(!MyRank()) server.Start(commPort, clientUpdateFrequency);
+
+  if(!MyRank()) std::cout << "\n[SIMULATION BEGINS]\n";
+
+  double tNextUpdate = MPI_Wtime();
+  double tLast = MPI_Wtime();
+  for(int i = 0; i < iterationLimit || !iterationLimit; i++) {
+    if(!MyRank() && MPI_Wtime() >= tNextUpdate) {
+      server.SetBodyData(ensemble.GetBodyData(0));
+      tNextUpdate = MPI_Wtime() + (1.0 / clientUpdateFrequency);
+    }
+
+    double tIteration;
+    try {
+      tIteration = ensemble.Iterate(engine);
+    } catch(cl::Error err) {
+      std::cout << err.what() << "(" << err.err() << ")\n";
+      exit(1);
+    }
+
+    // Ranks step independently, report the slowest
+    double tSlowest;
+    MPI_Reduce(
+      &tIteration, &tSlowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(!MyRank()) {
+      std::cout << "Iteration " << i << ") time: " << tSlowest << "s\n";
+    }
+
+    // Every member is a full direct sum
+    if(!MyRank() && metricsPort > 0) {
+      double tNow = MPI_Wtime();
+      double interactions =
+        (double)ensembleSize * bodies.size() * (bodies.size() - 1.0);
+      metrics.steps.Add();
+      metrics.interactions.Add(interactions);
+      metrics.stepRate.Set(1 / (tNow - tLast));
+      metrics.interactionRate.Set(interactions / (tNow - tLast));
+      metrics.stepTime.Observe(tNow - tLast);
+      metrics.phaseTime[PHASE_FORCES].Observe(tSlowest);
+      tLast = tNow;
+    }
+  }
+
+  MPI_Finalize();
+  return 0;
+}
+
+
+// Dedicated i/o rank, serves snapshots from the compute ranks to clients
+// while they get on with the following steps
+int ServeSnapshots(
+  std::vector<Body> const& bodies, SnapshotStream& snapshots,
+  bool const streamDensity, DensityProjection& density,
+  bool const streamMotion, TrajectoryWriter* recorder,
+  int const snapshotCount, int const commPort,
+  int const clientUpdateFrequency, int const metricsPort) {
+
+  Metrics metrics;
+  Server server(bodies);
+  if(metricsPort > 0) {
+    metrics.Start(metricsPort);
+    server.SetMetrics(&metrics);
+  }
+  server.Start(commPort, clientUpdateFrequency);
+
+  std::cout << "\n[SIMULATION BEGINS]\n";
+
+  for(int i = 0; i < snapshotCount || !snapshotCount; i++) {
+    if(streamDensity) {
+      snapshots.Receive(density);
+      server.SetDensityData(density.Image());
+    } else {
+      std::vector<Body> const& frame = snapshots.Receive();
+      if(streamMotion) {
+        server.SetBodyData(
+          frame, snapshots.GetVelocities(),
+          snapshots.GetSimulationTime(), snapshots.GetTimestep());
+      } else {
+        server.SetBodyData(frame);
+      }
+      if(recorder) recorder->Write(frame, snapshots.GetSimulationTime());
+    }
+  }
+
+  MPI_Finalize();
+  return 0;
 }
 
 
 int main(int argc, char **argv) {
-  MPI_Init(&argc, &argv);
+  // Only the main thread talks to mpi, but it does so inside omp regions
+  int threadSupport;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSupport);
+  if(threadSupport < MPI_THREAD_FUNNELED) {
+    if(!MyRank()) std::cout << "The mpi library lacks funneled threading\n";
+    MPI_Finalize();
+    return 1;
+  }
 
   OptionParser opt(argc, argv, "mpigrav compute server");
   AddOptions(opt);
@@ -54,31 +304,111 @@ int main(int argc, char **argv) {
   int clientUpdateFrequency = opt.Get("updaterate");
   int threadCount = opt.Get("threadcount");
   int commPort = opt.Get("port");
+  int metricsPort = opt.Get("metricsport");
 
   if(!MyRank()) {
     std::cout << "\n[SYSTEM PARAMETERS]\n";
     std::cout << "Client update rate: " << clientUpdateFrequency << "\n";
     std::cout << "Communication port: " << commPort << "\n";
+    if(metricsPort > 0) std::cout << "Metrics port: " << metricsPort << "\n";
     std::cout << "Thread count: ";
     if(!opt.Specified("threadcount")) std::cout << "OMP_NUM_THREADS\n";
     else std::cout << threadCount << "\n";
   }
 
   int n = opt.Get("nbodies");
+  int tracerCount = opt.Get("tracers");
   float G = opt.Get("gravitation");
   float dt = opt.Get("timestep");
   float d = opt.Get("damping");
+  float courant = opt.Get("courant");
+  float dtMin = opt.Get("mintimestep");
+  float dtMax = opt.Get("maxtimestep");
   int iterationLimit = opt.Get("iterationlimit");
+  int ensembleSize = opt.Get("ensemble");
+  int ioRank = opt.Get("iorank");
+  int snapshotInterval = opt.Get("snapshotinterval");
+  std::string streamName = opt.Get("stream");
+  std::string recordPath = opt.Get("record");
+  int haloInterval = opt.Get("halointerval");
+  float linkingLength = opt.Get("linkinglength");
+  int haloMin = opt.Get("halomin");
+  std::string haloPath = opt.Get("halos");
+  int motion = opt.Get("motion");
+  int densityResolution = opt.Get("densityres");
+  float densityExtent = opt.Get("densityextent");
+  std::string engineName = opt.Get("engine");
+  std::string integratorName = opt.Get("integrator");
+  std::string tuningMode = opt.Get("tuning");
+  std::string cacheDir = opt.Get("cachedir");
+  std::string hugePages = opt.Get("hugepages");
+  int pinThreads = opt.Get("pinthreads");
+  int overlap = opt.Get("overlap");
+  int sharedMemory = opt.Get("sharedmemory");
+  int residentSteps = opt.Get("residentsteps");
+  float collisionRadius = opt.Get("collisionradius");
+  int reorderInterval = opt.Get("reorder");
+  float cutoff = opt.Get("cutoff");
+  std::string forceLawName = opt.Get("forcelaw");
+  float screeningLength = opt.Get("screening");
+  int meshSize = opt.Get("meshsize");
+  float boxSize = opt.Get("boxsize");
 
   if(!MyRank()) {
     std::cout << "\n[ALGORITHM PARAMETERS]\n";
     std::cout << "Body count: " << n << "\n";
+    if(tracerCount > 0) std::cout << "Tracer count: " << tracerCount << "\n";
+    if(ensembleSize > 0) std::cout << "Ensemble size: " << ensembleSize << "\n";
     std::cout << "Gravitation: " << G << "\n";
-    std::cout << "Timestep: " << dt << "\n";
+    std::cout << "Timestep: " << dt;
+    if(courant > 0) std::cout << " initial, adaptive (" << courant << ")";
+    std::cout << "\n";
     std::cout << "Damping factor: " << d << "\n";
+    std::cout << "Engine: " << engineName << "\n";
+    std::cout << "Integrator: " << integratorName << "\n";
+    if(residentSteps > 0) {
+      std::cout << "Resident steps: " << residentSteps << " per host wait\n";
+    }
+    if(ParseEngine(engineName) == ENGINE_PM) {
+      std::cout << "Mesh: " << meshSize << "^3, box size " << boxSize << "\n";
+    }
+    if(cutoff > 0) {
+      std::cout << "Cutoff: " << cutoff << ", " << forceLawName;
+      if(ParseForceLaw(forceLawName) == FORCE_SCREENED) {
+        std::cout << " (" << screeningLength << ")";
+      }
+      std::cout << "\n";
+    }
+    std::cout << "Collision radius: ";
+    if(collisionRadius <= 0) std::cout << "None\n";
+    else std::cout << collisionRadius << "\n";
     std::cout << "Iteration limit: ";
     if(!iterationLimit) std::cout << "None\n";
     else std::cout << iterationLimit << "\n";
+    if(ioRank) {
+      std::cout << "I/O rank: 0, snapshot every " << snapshotInterval;
+      std::cout << " steps\n";
+    }
+    std::cout << "Stream: " << streamName;
+    if(streamName == "density") {
+      std::cout << ", " << densityResolution << "^2 pixels every ";
+      std::cout << snapshotInterval << " steps";
+    } else if(motion) {
+      std::cout << " with velocities";
+    }
+    std::cout << "\n";
+    if(!recordPath.empty()) {
+      std::cout << "Recording: " << recordPath << ", every ";
+      std::cout << snapshotInterval << " steps\n";
+    }
+    if(haloInterval > 0) {
+      std::cout << "Halos: every " << haloInterval << " steps, linking ";
+      if(linkingLength > 0) std::cout << "length " << linkingLength;
+      else std::cout << "0.2 of the mean spacing";
+      std::cout << ", " << haloMin << "+ members";
+      if(!haloPath.empty()) std::cout << ", to " << haloPath;
+      std::cout << "\n";
+    }
   }
 
   if(!MyRank()) std::cout << "\n[INITIAL CONFIGURATION]\n";
@@ -88,46 +418,314 @@ int main(int argc, char **argv) {
 
   // Set some initial body positions
   if(!MyRank()) std::cout << "Initialising body positions\n";
-  std::vector<Body> bodies(n);
-  for(int i = 0; i < n; i++) {
-    bodies[i].m = 100000;
-    do {
-      bodies[i].r.x = ((float)((rand() % 65536) - 32768)) / 32768.0f;
-      bodies[i].r.y = ((float)((rand() % 65536) - 32768)) / 32768.0f;
-      bodies[i].r.z = ((float)((rand() % 65536) - 32768)) / 32768.0f;
-    } while(Magnitude(bodies[i].r) > 1.0f);
+  std::vector<Body> bodies = RandomBodies(n);
+  std::vector<Body> tracers = RandomBodies(std::max(tracerCount, 0));
+  for(unsigned i = 0; i < tracers.size(); i++) tracers[i].m = 0;
+  bodies.insert(bodies.end(), tracers.begin(), tracers.end());
+  engine_t engine = ParseEngine(engineName);
+
+  if(ioRank && (RankCount() < 2 || ensembleSize > 0)) {
+    if(!MyRank()) std::cout << "An i/o rank needs 2+ ranks & no ensemble\n";
+    MPI_Finalize();
+    return 1;
+  }
+  if(snapshotInterval < 1) snapshotInterval = 1;
+
+  // Clients refuse larger images
+  if(streamName == "density" && (densityResolution < 1 ||
+     densityResolution > _MPIGRAV_MAX_DENSITY_RESOLUTION)) {
+    if(!MyRank()) {
+      std::cout << "Density resolution must be 1 to ";
+      std::cout << _MPIGRAV_MAX_DENSITY_RESOLUTION << "\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // The mesh is split into slabs over the compute ranks
+  int computeRanks = RankCount() - (ioRank ? 1 : 0);
+  if(engine == ENGINE_PM && !ValidMeshSize(meshSize, computeRanks)) {
+    if(!MyRank()) {
+      std::cout << "Mesh size must be a power of two & a multiple of the ";
+      std::cout << computeRanks << " compute ranks\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Tracers aren't exchanged, only snapshots gather all of them
+  if(tracerCount > 0 && (ensembleSize > 0 || (!ioRank && RankCount() > 1))) {
+    if(!MyRank()) {
+      std::cout << "Tracers need an i/o rank or one rank & no ensemble\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  if(ensembleSize > 0) {
+    if((engine != ENGINE_CPU && engine != ENGINE_OPENCL) || cutoff > 0 ||
+       haloInterval > 0) {
+      if(!MyRank()) {
+        std::cout << "Ensembles need the cpu or opencl engine, no cutoff ";
+        std::cout << "& no halos\n";
+      }
+      MPI_Finalize();
+      return 1;
+    }
+    return RunEnsemble(
+      bodies, ensembleSize, G, dt, d, engine, cacheDir,
+      iterationLimit, commPort, clientUpdateFrequency, metricsPort);
   }
 
   // Initialise universe from initial body positions
-  Universe universe(bodies, G, dt, d);
+  UniverseConfig config;
+  config.cacheDir = cacheDir;
+  config.hugePages = ParseHugePageMode(hugePages);
+  config.pinThreads = pinThreads;
+  config.overlapExchange = overlap;
+  config.sharedMemory = sharedMemory;
+  config.residentSteps = std::max(residentSteps, 0);
+  config.collisionRadius = collisionRadius;
+  config.reorderInterval = reorderInterval;
+  config.meshSize = meshSize;
+  config.boxSize = boxSize;
+  config.integrator = ParseIntegrator(integratorName);
+  config.courant = courant;
+  config.dtMin = dtMin;
+  config.dtMax = dtMax;
+  config.cutoff = cutoff;
+  config.forceLaw = ParseForceLaw(forceLawName);
+  config.screeningLength = screeningLength;
+  if(!SupportsIntegrator(engine, config)) {
+    if(!MyRank()) {
+      std::cout << "Integrator " << integratorName << " needs the cpu or ";
+      std::cout << "opencl engine without overlap\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  if(!SupportsShortRange(engine, config)) {
+    if(!MyRank()) {
+      std::cout << "A cutoff needs the cpu or opencl engine without overlap, ";
+      std::cout << "shared memory or hermite\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Only halos are exchanged, only snapshots gather all positions
+  if(cutoff > 0 && !ioRank && RankCount() > 1) {
+    if(!MyRank()) std::cout << "A cutoff needs an i/o rank or one rank\n";
+    MPI_Finalize();
+    return 1;
+  }
+  if(sharedMemory && overlap) {
+    if(!MyRank()) std::cout << "Shared memory buffers need overlap off\n";
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Merging needs every position, so it would finish each exchange early
+  if(collisionRadius > 0 && overlap) {
+    if(!MyRank()) std::cout << "Collisions need overlap off\n";
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Velocities lag positions under overlap & only the snapshot gather
+  // collects the other ranks' velocities
+  if(motion && (overlap || (!ioRank && RankCount() > 1))) {
+    if(!MyRank()) {
+      std::cout << "Motion needs overlap off & an i/o rank or one rank\n";
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // Snapshots are recorded by rank 0, the i/o rank or the leader
+  std::unique_ptr<TrajectoryWriter> recorder;
+  if(!recordPath.empty()) {
+    int recording = streamName != "density";
+    if(!recording && !MyRank()) {
+      std::cout << "Recording needs the bodies stream\n";
+    }
+    if(recording && !MyRank()) {
+      try {
+        recorder.reset(new TrajectoryWriter(recordPath));
+      } catch(std::exception& e) {
+        std::cout << e.what() << "\n";
+        recording = 0;
+      }
+    }
+    MPI_Bcast(&recording, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(!recording) {
+      MPI_Finalize();
+      return 1;
+    }
+  }
+
+  // Catalogues are written by the compute leader, rank 1 with an i/o rank
+  std::unique_ptr<HaloCatalogueWriter> haloWriter;
+  if(haloInterval > 0 && !haloPath.empty()) {
+    int haloRank = ioRank ? 1 : 0;
+    int opened = 1;
+    if(MyRank() == haloRank) {
+      try {
+        haloWriter.reset(new HaloCatalogueWriter(haloPath));
+      } catch(std::exception& e) {
+        std::cout << e.what() << "\n";
+        opened = 0;
+      }
+    }
+    MPI_Bcast(&opened, 1, MPI_INT, haloRank, MPI_COMM_WORLD);
+    if(!opened) {
+      MPI_Finalize();
+      return 1;
+    }
+  }
+  HaloFinder haloFinder(linkingLength, std::max(haloMin, 1));
+
+  // Clients get either bodies or a fixed size image of the mass
+  bool streamDensity = streamName == "density";
+  bool streamMotion = motion && !streamDensity;
+  DensityProjection density(densityResolution, densityExtent);
+
+  // With an i/o rank the remaining ranks split the bodies between them
+  SnapshotStream snapshots(MPI_COMM_WORLD, 0, streamMotion);
+  if(ioRank) {
+    MPI_Comm_split(
+      MPI_COMM_WORLD, MyRank() ? 0 : MPI_UNDEFINED, MyRank(), &config.comm);
+    if(!MyRank()) {
+      int snapshotCount = iterationLimit ?
+        (iterationLimit + snapshotInterval - 1) / snapshotInterval : 0;
+      return ServeSnapshots(
+        bodies, snapshots, streamDensity, density, streamMotion,
+        recorder.get(), snapshotCount, commPort, clientUpdateFrequency,
+        metricsPort);
+    }
+  }
+  bool leader = !MyRank(config.comm);
+
+  // Freed before mpi is finalised, it holds communicators & windows
+  std::unique_ptr<Universe> universe(new Universe(bodies, G, dt, d, config));
+
+  // Pick kernel launch parameters for this device
+  if(engine == ENGINE_OPENCL) {
+    try {
+      universe->TuneCL(ParseTuningMode(tuningMode));
+    } catch(cl::Error err) {
+      std::cout << err.what() << "(" << err.err() << ")\n";
+      exit(1);
+    }
+  }
+
+  // The compute leader keeps metrics, an i/o rank has its own
+  Metrics metrics;
+  bool keepMetrics = metricsPort > 0 && leader;
+  if(keepMetrics) metrics.Start(ioRank ? metricsPort + 1 : metricsPort);
 
   // Listen for incoming client connections (only on rank 0)
   Server server(bodies);
-  if(!MyRank()) server.Start(commPort, clientUpdateFrequency);
+  if(keepMetrics) server.SetMetrics(&metrics);
+  if(!ioRank && leader) server.Start(commPort, clientUpdateFrequency);
 
-  if(!MyRank()) std::cout << "\n[SIMULATION BEGINS]\n";
+  if(!ioRank && leader) std::cout << "\n[SIMULATION BEGINS]\n";
 
   // Limit number of iterations based on command line option
+  double tNextUpdate = MPI_Wtime();
+  double tLast = MPI_Wtime();
   for(int i = 0; i < iterationLimit || !iterationLimit; i++) {
+    double tOutput = MPI_Wtime();
 
-    // Update server body data
-    server.SetBodyData(universe.GetBodyData());
+    // Update server body data, no more often than clients are updated
+    // Density images are built by all ranks together, so every few steps
+    if(streamDensity) {
+      if(i % snapshotInterval == 0) {
+        universe->ProjectDensity(density);
+        if(ioRank) {
+          snapshots.Send(density);
+        } else {
+          density.Reduce(0, config.comm);
+          if(leader) server.SetDensityData(density.Image());
+        }
+      }
+    } else if(ioRank) {
+      if(i % snapshotInterval == 0) snapshots.Send(*universe);
+    } else if(leader && MPI_Wtime() >= tNextUpdate) {
+      if(streamMotion) {
+        server.SetBodyData(
+          universe->GetBodyData(), universe->GetVelocityData(),
+          universe->GetSimulationTime(), universe->GetTimestepSize());
+      } else {
+        server.SetBodyData(universe->GetBodyData());
+      }
+      tNextUpdate = MPI_Wtime() + (1.0 / clientUpdateFrequency);
+    }
+    if(recorder && i % snapshotInterval == 0) {
+      recorder->Write(universe->GetBodyData(), universe->GetSimulationTime());
+    }
+    tOutput = MPI_Wtime() - tOutput;
 
     // Perform the iteration
     double tIteration;
     try {
-      tIteration = universe.IterateCL();
+      tIteration = universe->Iterate(engine);
     } catch(cl::Error err) {
       std::cout << err.what() << "(" << err.err() << ")\n";
       exit(1);
     }
+    if(ioRank) snapshots.Poll();
 
     // Print out the iteration time
-    if(!MyRank()) {
-      std::cout << "Iteration " << i << ") time: " << tIteration << "s\n";
+    if(leader) {
+      std::cout << "Iteration " << i << ") time: " << tIteration << "s";
+      if(courant > 0) std::cout << ", dt: " << universe->GetTimestepSize();
+      std::cout << "\n";
+    }
+
+    // Only the catalogue leaves the compute ranks
+    double tHalos = 0;
+    if(haloInterval > 0 && (i + 1) % haloInterval == 0) {
+      tHalos = MPI_Wtime();
+      universe->FindHalos(haloFinder);
+      std::vector<Halo> const& halos = haloFinder.Halos();
+      if(haloWriter) {
+        haloWriter->Write(halos, i + 1, universe->GetSimulationTime());
+      }
+      if(leader) {
+        std::cout << "Halos: " << halos.size();
+        if(!halos.empty()) {
+          std::cout << ", largest " << halos[0].memberCount << " members";
+        }
+        std::cout << "\n";
+      }
+      tHalos = MPI_Wtime() - tHalos;
+    }
+
+    // A handful of relaxed atomics, nothing waits on a scrape
+    if(keepMetrics) {
+      double tNow = MPI_Wtime();
+      StepStats stats = universe->GetStepStats();
+      metrics.steps.Add();
+      metrics.interactions.Add(stats.interactions);
+      metrics.stepRate.Set(1 / (tNow - tLast));
+      metrics.interactionRate.Set(stats.interactions / (tNow - tLast));
+      metrics.simulationTime.Set(universe->GetSimulationTime());
+      metrics.stepTime.Observe(tNow - tLast);
+      metrics.phaseTime[PHASE_CHANGES].Observe(stats.tChanges);
+      metrics.phaseTime[PHASE_FORCES].Observe(stats.tForces);
+      metrics.phaseTime[PHASE_COLLISIONS].Observe(stats.tCollisions);
+      metrics.phaseTime[PHASE_REORDER].Observe(stats.tReorder);
+      metrics.phaseTime[PHASE_TIMESTEP].Observe(stats.tTimestep);
+      metrics.phaseTime[PHASE_OUTPUT].Observe(tOutput);
+      metrics.phaseTime[PHASE_HALOS].Observe(tHalos);
+      tLast = tNow;
     }
   }
+  if(ioRank) snapshots.Finish();
 
+  universe.reset();
+  if(ioRank) MPI_Comm_free(&config.comm);
   MPI_Finalize();
   return 0;
 }